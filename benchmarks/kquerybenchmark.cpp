@@ -0,0 +1,244 @@
+/*******************************************************************
+* kquerybenchmark.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include <pwd.h>
+#include <unistd.h>
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <kfileitem.h>
+
+#include "kquery.h"
+#include "treegenerator.h"
+
+/* Benchmarks KQuery against a generated tree.
+ *
+ * The tree can be scaled with the KFIND_BENCHMARK_DEPTH, KFIND_BENCHMARK_FANOUT
+ * and KFIND_BENCHMARK_FILES environment variables. Besides the wall time
+ * reported to QTest every case prints files/s, bytes/s, read and write calls
+ * per file and the time to the first result. Bytes and calls are read from
+ * /proc/self/io: they count the read() and write() family of this process
+ * only, no stat() or other calls, and nothing done inside out-of-process KIO
+ * workers. */
+class KQueryBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void nameOnly();
+    void sizeAndTime();
+    void owner();
+    void mimeType();
+    void content();
+    void contentCaseSensitive();
+    void allContentMatches();
+    void firstContentMatch();
+    void duplicates();
+
+private:
+    struct IoCounters {
+        IoCounters()
+            : bytesRead(0)
+            , readWriteCalls(0)
+        {
+        }
+
+        qint64 bytesRead;
+        qint64 readWriteCalls;
+    };
+
+    static IoCounters ioCounters();
+    static int envValue(const char *name, int defaultValue);
+
+    KQuery *newQuery();
+    int runQuery(KQuery *query, const char *name);
+
+    QTemporaryDir m_dir;
+    TreeGenerator::Settings m_settings;
+    TreeGenerator m_generator;
+};
+
+int KQueryBenchmark::envValue(const char *name, int defaultValue)
+{
+    bool ok = false;
+    const int value = qEnvironmentVariableIntValue(name, &ok);
+    return ok ? value : defaultValue;
+}
+
+KQueryBenchmark::IoCounters KQueryBenchmark::ioCounters()
+{
+    IoCounters counters;
+    QFile io(QStringLiteral("/proc/self/io"));
+    if (!io.open(QIODevice::ReadOnly)) {
+        return counters;
+    }
+    const QList<QByteArray> lines = io.readAll().split('\n');
+    for (const QByteArray &line : lines) {
+        const int colon = line.indexOf(':');
+        const QByteArray key = line.left(colon);
+        const qint64 value = line.mid(colon + 1).trimmed().toLongLong();
+        if (key == "rchar") {
+            counters.bytesRead = value;
+        } else if (key == "syscr" || key == "syscw") {
+            counters.readWriteCalls += value;
+        }
+    }
+    return counters;
+}
+
+void KQueryBenchmark::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+
+    m_settings.depth = envValue("KFIND_BENCHMARK_DEPTH", m_settings.depth);
+    m_settings.fanOut = envValue("KFIND_BENCHMARK_FANOUT", m_settings.fanOut);
+    m_settings.filesPerDir = envValue("KFIND_BENCHMARK_FILES", m_settings.filesPerDir);
+    m_generator = TreeGenerator(m_settings);
+
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(m_generator.generate(m_dir.path()));
+    qInfo("Generated %d files in %d folders (%lld bytes) in %lld ms",
+          m_generator.fileCount(), m_generator.dirCount(), m_generator.totalBytes(), timer.elapsed());
+}
+
+KQuery *KQueryBenchmark::newQuery()
+{
+    KQuery *query = new KQuery(this);
+    query->setPath(QUrl::fromLocalFile(m_dir.path()));
+    query->setRegExp(QStringLiteral("*"), false);
+    query->setRecursive(true);
+    return query;
+}
+
+int KQueryBenchmark::runQuery(KQuery *query, const char *name)
+{
+    int found = 0;
+    qint64 firstResult = -1;
+    QElapsedTimer timer;
+    QEventLoop loop;
+
+    connect(query, &KQuery::foundFileList, &loop, [&](const QList<KQueryResult> &list) {
+        if (firstResult < 0) {
+            firstResult = timer.nsecsElapsed();
+        }
+        found += list.size();
+    });
+    connect(query, &KQuery::result, &loop, &QEventLoop::quit);
+
+    const IoCounters before = ioCounters();
+    timer.start();
+    query->start();
+    loop.exec();
+    const qint64 elapsed = qMax<qint64>(timer.nsecsElapsed(), 1);
+    const IoCounters after = ioCounters();
+
+    const double seconds = elapsed / 1e9;
+    const int files = m_generator.fileCount() + m_generator.dirCount();
+    qInfo("%s: %d found, %.0f files/s, %.0f bytes/s, %.2f read/write calls/file, first result after %.3f ms",
+          name, found, files / seconds, (after.bytesRead - before.bytesRead) / seconds,
+          double(after.readWriteCalls - before.readWriteCalls) / files, firstResult < 0 ? -1.0 : firstResult / 1e6);
+
+    QTest::setBenchmarkResult(elapsed / 1e6, QTest::WalltimeMilliseconds);
+    delete query;
+    return found;
+}
+
+void KQueryBenchmark::nameOnly()
+{
+    KQuery *query = newQuery();
+    query->setRegExp(QStringLiteral("*.txt;*.odt"), false);
+    QVERIFY(runQuery(query, "name") > 0);
+}
+
+void KQueryBenchmark::sizeAndTime()
+{
+    KQuery *query = newQuery();
+    query->setSizeRange(1, m_settings.maxFileSize / 2, 0);
+    const time_t now = time(nullptr);
+    query->setTimeRange(0, now);
+    QVERIFY(runQuery(query, "size/time") > 0);
+}
+
+void KQueryBenchmark::owner()
+{
+    KQuery *query = newQuery();
+    const struct passwd *pw = getpwuid(geteuid());
+    QVERIFY(pw);
+    query->setUsername(QString::fromLocal8Bit(pw->pw_name));
+    QVERIFY(runQuery(query, "owner") > 0);
+}
+
+void KQueryBenchmark::mimeType()
+{
+    KQuery *query = newQuery();
+    // any index past the special file types selects the MIME type list
+    query->setFileType(7);
+    query->setMimeType(QStringList() << QStringLiteral("text/plain"));
+    QVERIFY(runQuery(query, "mimetype") > 0);
+}
+
+void KQueryBenchmark::content()
+{
+    KQuery *query = newQuery();
+    query->setContext(QString::fromLatin1(m_settings.needle), false, false, false);
+    const int found = runQuery(query, "content");
+    QCOMPARE(found, m_generator.needleCount());
+}
+
+// Should take about as long as the case insensitive content()
+void KQueryBenchmark::contentCaseSensitive()
+{
+    KQuery *query = newQuery();
+    query->setContext(QString::fromLatin1(m_settings.needle), true, false, false);
+    QCOMPARE(runQuery(query, "content, case sensitive"), m_generator.needleCount());
+}
+
+void KQueryBenchmark::allContentMatches()
+{
+    KQuery *query = newQuery();
+    query->setContext(QString::fromLatin1(m_settings.needle), false, false, false);
+    query->setAllMatches(true, 2);
+    QCOMPARE(runQuery(query, "all content matches"), m_generator.needleCount());
+}
+
+void KQueryBenchmark::firstContentMatch()
+{
+    KQuery *query = newQuery();
+    query->setContext(QString::fromLatin1(m_settings.needle), false, false, false);
+    query->setMaxResults(1);
+    QCOMPARE(runQuery(query, "first content match"), qMin(1, m_generator.needleCount()));
+}
+
+// The generated files are random, so this mostly measures how many files of
+// equal size have their ends hashed
+void KQueryBenchmark::duplicates()
+{
+    KQuery *query = newQuery();
+    query->setFindDuplicates(true);
+    runQuery(query, "duplicates");
+}
+
+QTEST_GUILESS_MAIN(KQueryBenchmark)
+
+#include "kquerybenchmark.moc"
@@ -0,0 +1,213 @@
+/*******************************************************************
+* treegenerator.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "treegenerator.h"
+
+#include <sys/time.h>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <kzip.h>
+
+static const char *const words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+    "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+    "et", "dolore", "magna", "aliqua", "enim", "ad", "minim", "veniam"
+};
+static const int wordCount = sizeof(words) / sizeof(words[0]);
+
+// Modification times are spread over the year before this date
+static const time_t baseTime = 1514764800; // 2018-01-01
+
+TreeGenerator::Settings::Settings()
+    : depth(4)
+    , fanOut(4)
+    , filesPerDir(20)
+    , minFileSize(512)
+    , maxFileSize(64 * 1024)
+    , binaryPercent(20)
+    , officePercent(5)
+    , needlePercent(10)
+    , needle("kfindneedle")
+    , seed(0x6b66696e)
+{
+}
+
+TreeGenerator::TreeGenerator(const Settings &settings)
+    : m_settings(settings)
+    , m_state(settings.seed ? settings.seed : 1)
+    , m_dirs(0)
+    , m_files(0)
+    , m_needles(0)
+    , m_bytes(0)
+{
+}
+
+bool TreeGenerator::generate(const QString &root)
+{
+    m_state = m_settings.seed ? m_settings.seed : 1;
+    m_dirs = m_files = m_needles = 0;
+    m_bytes = 0;
+    return generateDir(root, 0);
+}
+
+// xorshift32, so the tree does not depend on the C library's rand()
+quint32 TreeGenerator::random()
+{
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 17;
+    m_state ^= m_state << 5;
+    return m_state;
+}
+
+int TreeGenerator::randomBetween(int min, int max)
+{
+    if (max <= min) {
+        return min;
+    }
+    return min + int(random() % quint32(max - min + 1));
+}
+
+bool TreeGenerator::generateDir(const QString &path, int level)
+{
+    m_dirs++;
+
+    for (int i = 0; i < m_settings.filesPerDir; i++) {
+        const int kind = randomBetween(0, 99);
+        const int size = randomBetween(m_settings.minFileSize, m_settings.maxFileSize);
+        const bool withNeedle = randomBetween(0, 99) < m_settings.needlePercent;
+        const QString base = path + QStringLiteral("/file%1").arg(i);
+
+        QString fileName;
+        bool ok;
+        if (kind < m_settings.officePercent) {
+            fileName = base + QStringLiteral(".odt");
+            ok = writeOfficeFile(fileName, size, withNeedle);
+            m_needles += withNeedle;
+        } else if (kind < m_settings.officePercent + m_settings.binaryPercent) {
+            fileName = base + QStringLiteral(".bin");
+            ok = writeBinaryFile(fileName, size);
+        } else {
+            fileName = base + QStringLiteral(".txt");
+            ok = writeTextFile(fileName, size, withNeedle);
+            m_needles += withNeedle;
+        }
+        if (!ok) {
+            return false;
+        }
+
+        const struct timeval times[2] = {
+            { long(baseTime - randomBetween(0, 365 * 24 * 3600)), 0 },
+            { long(baseTime - randomBetween(0, 365 * 24 * 3600)), 0 }
+        };
+        utimes(QFile::encodeName(fileName).constData(), times);
+        m_files++;
+    }
+
+    if (level < m_settings.depth) {
+        for (int i = 0; i < m_settings.fanOut; i++) {
+            const QString subDir = path + QStringLiteral("/dir%1").arg(i);
+            if (!QDir().mkdir(subDir) || !generateDir(subDir, level + 1)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+QByteArray TreeGenerator::textContent(int size, bool withNeedle)
+{
+    QByteArray content;
+    content.reserve(size + 32);
+    const int needleAt = withNeedle ? randomBetween(0, size) : -1;
+    bool inserted = false;
+
+    while (content.size() < size) {
+        if (needleAt >= 0 && !inserted && content.size() >= needleAt) {
+            content.append(m_settings.needle);
+            content.append(' ');
+            inserted = true;
+        }
+        content.append(words[random() % wordCount]);
+        content.append(random() % 12 ? ' ' : '\n');
+    }
+    if (withNeedle && !inserted) {
+        content.append(m_settings.needle);
+    }
+    content.append('\n');
+    return content;
+}
+
+bool TreeGenerator::writeTextFile(const QString &path, int size, bool withNeedle)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    const QByteArray content = textContent(size, withNeedle);
+    m_bytes += content.size();
+    return file.write(content) == content.size();
+}
+
+bool TreeGenerator::writeBinaryFile(const QString &path, int size)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    QByteArray content(size, '\0');
+    for (int i = 0; i < size; i++) {
+        // mostly zero bytes so every binary check recognizes it
+        content[i] = (random() % 4) ? '\0' : char(random());
+    }
+    m_bytes += size;
+    return file.write(content) == content.size();
+}
+
+bool TreeGenerator::writeOfficeFile(const QString &path, int size, bool withNeedle)
+{
+    KZip zip(path);
+    if (!zip.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    // mimetype has to be stored first and uncompressed, as in real documents
+    zip.setCompression(KZip::NoCompression);
+    zip.writeFile(QStringLiteral("mimetype"), QByteArray("application/vnd.oasis.opendocument.text"));
+    zip.setCompression(KZip::DeflateCompression);
+
+    QByteArray xml("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                   "<office:document-content xmlns:office=\"urn:oasis:names:tc:opendocument:xmlns:office:1.0\" "
+                   "xmlns:text=\"urn:oasis:names:tc:opendocument:xmlns:text:1.0\"><office:body><office:text>");
+    const QList<QByteArray> lines = textContent(size, withNeedle).split('\n');
+    for (const QByteArray &line : lines) {
+        xml.append("<text:p>");
+        xml.append(line);
+        xml.append("</text:p>\n");
+    }
+    xml.append("</office:text></office:body></office:document-content>\n");
+    zip.writeFile(QStringLiteral("content.xml"), xml);
+
+    if (!zip.close()) {
+        return false;
+    }
+    m_bytes += QFileInfo(path).size();
+    return true;
+}
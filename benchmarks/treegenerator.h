@@ -0,0 +1,89 @@
+/*******************************************************************
+* treegenerator.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef TREEGENERATOR_H
+#define TREEGENERATOR_H
+
+#include <QByteArray>
+#include <QString>
+
+/* Creates a deterministic synthetic folder tree for benchmarking.
+ * The same settings and seed always produce the same names, sizes,
+ * contents and modification times. */
+class TreeGenerator
+{
+public:
+    struct Settings {
+        Settings();
+
+        int depth;              // folder levels below the root
+        int fanOut;             // subfolders per folder
+        int filesPerDir;
+        int minFileSize;        // bytes
+        int maxFileSize;        // bytes
+        int binaryPercent;      // share of binary files
+        int officePercent;      // share of OpenDocument (zip) files
+        int needlePercent;      // share of text files containing needle
+        QByteArray needle;
+        quint32 seed;
+    };
+
+    explicit TreeGenerator(const Settings &settings = Settings());
+
+    /* Fills root, which must be an existing empty folder */
+    bool generate(const QString &root);
+
+    int dirCount() const
+    {
+        return m_dirs;
+    }
+
+    int fileCount() const
+    {
+        return m_files;
+    }
+
+    int needleCount() const
+    {
+        return m_needles;
+    }
+
+    qint64 totalBytes() const
+    {
+        return m_bytes;
+    }
+
+private:
+    bool generateDir(const QString &path, int level);
+    bool writeTextFile(const QString &path, int size, bool withNeedle);
+    bool writeBinaryFile(const QString &path, int size);
+    bool writeOfficeFile(const QString &path, int size, bool withNeedle);
+    QByteArray textContent(int size, bool withNeedle);
+
+    quint32 random();
+    int randomBetween(int min, int max);
+
+    Settings m_settings;
+    quint32 m_state;
+    int m_dirs;
+    int m_files;
+    int m_needles;
+    qint64 m_bytes;
+};
+
+#endif
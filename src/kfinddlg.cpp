@@ -19,18 +19,25 @@
 #include "kfinddlg.h"
 
 #include <QLayout>
+#include <QLocale>
 #include <QPushButton>
+#include <QTimer>
 
+#include <KFormat>
 #include <KLocalizedString>
+#include <KStringHandler>
 #include <kstatusbar.h>
 #include <kmessagebox.h>
 #include <kaboutapplicationdialog.h>
 #include <khelpmenu.h>
 #include <qmenu.h>
 #include <kcomponentdata.h>
+#include <kconfiggroup.h>
+#include <KSharedConfig>
 
 #include "kftabdlg.h"
 #include "kquery.h"
+#include "kqueryduplicates.h"
 #include "kfindtreeview.h"
 
 KfindDlg::KfindDlg(const QUrl &url, QWidget *parent)
@@ -52,6 +59,7 @@ KfindDlg::KfindDlg(const QUrl &url, QWidget *parent)
     enableButton(User1, false); // Disable "Save As..."
 
     isResultReported = false;
+    m_reclaimable = 0;
 
     QFrame *frame = new QFrame;
     setMainWidget(frame);
@@ -71,6 +79,16 @@ KfindDlg::KfindDlg(const QUrl &url, QWidget *parent)
     mStatusBar->insertPermanentItem(QString(), 1, 1);
     mStatusBar->setItemAlignment(1, Qt::AlignRight | Qt::AlignVCenter);
 
+    const KConfigGroup generalGroup(KSharedConfig::openConfig(), "General");
+    m_showStatistics = generalGroup.readEntry("ShowSearchStatistics", false);
+    m_statisticsTimer = new QTimer(this);
+    m_statisticsTimer->setInterval(500);
+    connect(m_statisticsTimer, &QTimer::timeout, this, &KfindDlg::updateStatistics);
+    if (m_showStatistics) {
+        mStatusBar->insertPermanentItem(QString(), 2, 0);
+        mStatusBar->setItemAlignment(2, Qt::AlignRight | Qt::AlignVCenter);
+    }
+
     QVBoxLayout *vBox = new QVBoxLayout(frame);
     vBox->addWidget(tabWidget, 0);
     vBox->addWidget(win, 1);
@@ -92,7 +110,9 @@ KfindDlg::KfindDlg(const QUrl &url, QWidget *parent)
 
     query = new KQuery(frame);
     connect(query, SIGNAL(result(int)), SLOT(slotResult(int)));
-    connect(query, SIGNAL(foundFileList(QList<QPair<KFileItem,QString> >)), SLOT(addFiles(QList<QPair<KFileItem,QString> >)));
+    connect(query, &KQuery::foundFileList, this, &KfindDlg::addFiles);
+    connect(query, &KQuery::progress, this, &KfindDlg::updateProgress);
+    connect(query, &KQuery::otherLinksFound, win, &KFindTreeView::updateOtherLinks);
 
     KHelpMenu *helpMenu = new KHelpMenu(this, KAboutData::applicationData(), true);
     setButtonMenu(Help, helpMenu->menu());
@@ -128,6 +148,7 @@ void KfindDlg::startSearch()
     tabWidget->setQuery(query);
 
     isResultReported = false;
+    m_reclaimable = 0;
 
     // Reset count - use the same i18n as below
     setProgressMsg(i18np("one item found", "%1 items found", 0));
@@ -171,6 +192,10 @@ void KfindDlg::startSearch()
 
     setStatusMsg(i18n("Searching..."));
     query->start();
+
+    if (m_showStatistics) {
+        m_statisticsTimer->start();
+    }
 }
 
 void KfindDlg::stopSearch()
@@ -211,20 +236,67 @@ void KfindDlg::slotResult(int errorCode)
     enableButton(User2, false); // Disable "Stop"
     enableButton(User1, true); // Enable "Save As..."
 
+    m_statisticsTimer->stop();
+    updateStatistics();
+
     win->endSearch();
     tabWidget->endSearch();
     setFocus();
 }
 
-void KfindDlg::addFiles(const QList< QPair<KFileItem, QString> > &pairs)
+void KfindDlg::updateStatistics()
+{
+    if (m_showStatistics) {
+        mStatusBar->changeItem(query->statistics().toDisplayString(), 2);
+    }
+}
+
+void KfindDlg::updateProgress(const KQueryProgress &progress)
 {
-    win->insertItems(pairs);
+    QStringList details;
+    details << i18nc("search speed", "%1 files/s", QLocale().toString(qRound64(progress.filesPerSecond)));
+    if (progress.bytesPerSecond > 0) {
+        details << i18nc("search speed, %1 is a size", "%1/s", KIO::convertSize(KIO::filesize_t(progress.bytesPerSecond)));
+    }
+    if (progress.pendingDirs > 0) {
+        details << i18np("one folder left", "%1 folders left", progress.pendingDirs);
+    }
+    if (progress.remainingTime >= 0) {
+        details << i18nc("estimated time until the search is done", "about %1 left",
+                         KFormat().formatSpelloutDuration(quint64(progress.remainingTime)));
+    }
+
+    const QString separator = i18nc("separator of the search progress details", ", ");
+    if (progress.currentDir.isEmpty()) {
+        setStatusMsg(i18nc("@info:status", "Searching... (%1)", details.join(separator)));
+    } else {
+        const QString dir = KStringHandler::csqueeze(progress.currentDir.toDisplayString(QUrl::PreferLocalFile), 50);
+        setStatusMsg(i18nc("@info:status %1 is a folder", "Searching %1 (%2)", dir, details.join(separator)));
+    }
+}
+
+void KfindDlg::addFiles(const QList<KQueryResult> &results)
+{
+    win->insertItems(results);
 
     if (!isResultReported) {
         emit haveResults(true);
         isResultReported = true;
     }
 
+    for (const KQueryResult &result : results) {
+        // Every group once, at its first copy
+        if (result.duplicates && result.duplicates->paths.first() == result.item.url().toLocalFile()) {
+            m_reclaimable += result.duplicates->reclaimable();
+        }
+    }
+
+    if (m_reclaimable > 0) {
+        setProgressMsg(i18np("one item found, %2 reclaimable", "%1 items found, %2 reclaimable",
+                             win->itemCount(), KIO::convertSize(m_reclaimable)));
+        return;
+    }
+
     const QString str = i18np("one item found", "%1 items found", win->itemCount());
     setProgressMsg(str);
 }
@@ -22,6 +22,7 @@
 #include <kdialog.h>
 #include <kdirlister.h>
 #include <kdirwatch.h>
+#include <kio/global.h>
 
 #include <qglobal.h>
 
@@ -32,8 +33,11 @@ QT_FORWARD_DECLARE_CLASS(QUrl)
 class KQuery;
 class KFileItem;
 class KfindTabWidget;
+struct KQueryProgress;
+struct KQueryResult;
 class KFindTreeView;
 class KStatusBar;
+class QTimer;
 
 class KfindDlg : public KDialog
 {
@@ -55,7 +59,7 @@ public Q_SLOTS:
     void startSearch();
     void stopSearch();
     void newSearch();
-    void addFiles(const QList< QPair<KFileItem, QString> > &);
+    void addFiles(const QList<KQueryResult> &);
     void setFocus();
     void slotResult(int);
 //  void slotSearchDone();
@@ -65,6 +69,10 @@ public Q_SLOTS:
 
     void finishAndClose();
 
+private Q_SLOTS:
+    void updateStatistics();
+    void updateProgress(const KQueryProgress &);
+
 Q_SIGNALS:
     void haveResults(bool);
     void resultSelected(bool);
@@ -74,10 +82,16 @@ private:
     KFindTreeView *win;
 
     bool isResultReported;
+    // Sum over the groups of a duplicate search
+    KIO::filesize_t m_reclaimable;
     KQuery *query;
     KStatusBar *mStatusBar;
     KDirLister *dirlister;
     KDirWatch *dirwatch;
+
+    // Optional per-stage search counters in the status bar
+    bool m_showStatistics;
+    QTimer *m_statisticsTimer;
 };
 
 #endif
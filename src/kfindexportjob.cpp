@@ -0,0 +1,340 @@
+/*******************************************************************
+* kfindexportjob.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kfindexportjob.h"
+
+#include <QFile>
+#include <QTextCodec>
+#include <QTimer>
+
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <KLocalizedString>
+#include <kio/global.h>
+
+// Bytes collected before they are handed to the file
+static const int exportBufferSize = 1024 * 1024;
+
+namespace {
+
+class ExportBuffer
+{
+public:
+    explicit ExportBuffer(QFile *file)
+        : m_file(file)
+        , m_ok(true)
+    {
+        m_buffer.reserve(exportBufferSize);
+    }
+
+    void append(const QByteArray &data)
+    {
+        m_buffer.append(data);
+        flushIfFull();
+    }
+
+    void append(const char *data)
+    {
+        m_buffer.append(data);
+        flushIfFull();
+    }
+
+    void append(char c)
+    {
+        m_buffer.append(c);
+        flushIfFull();
+    }
+
+    void appendNumber(qulonglong number)
+    {
+        char digits[24];
+        int pos = sizeof(digits);
+        do {
+            digits[--pos] = char('0' + number % 10);
+            number /= 10;
+        } while (number);
+        m_buffer.append(digits + pos, sizeof(digits) - pos);
+        flushIfFull();
+    }
+
+    void appendOctal(uint number)
+    {
+        char digits[8];
+        int pos = sizeof(digits);
+        for (int i = 0; i < 4 || number; i++) {
+            digits[--pos] = char('0' + (number & 7));
+            number >>= 3;
+        }
+        m_buffer.append(digits + pos, sizeof(digits) - pos);
+        flushIfFull();
+    }
+
+    // JSON string literal, UTF-8 encoded
+    void appendJson(const QString &str)
+    {
+        const QByteArray utf8 = str.toUtf8();
+        m_buffer.append('"');
+        for (const char c : utf8) {
+            switch (c) {
+            case '"':
+                m_buffer.append("\\\"");
+                break;
+            case '\\':
+                m_buffer.append("\\\\");
+                break;
+            case '\n':
+                m_buffer.append("\\n");
+                break;
+            case '\r':
+                m_buffer.append("\\r");
+                break;
+            case '\t':
+                m_buffer.append("\\t");
+                break;
+            default:
+                if (uchar(c) < 0x20) {
+                    static const char hex[] = "0123456789abcdef";
+                    m_buffer.append("\\u00");
+                    m_buffer.append(hex[uchar(c) >> 4]);
+                    m_buffer.append(hex[uchar(c) & 0xf]);
+                } else {
+                    m_buffer.append(c);
+                }
+            }
+        }
+        m_buffer.append('"');
+        flushIfFull();
+    }
+
+    // RFC 4180 field, quoted only when needed
+    void appendCsv(const QString &str)
+    {
+        const QByteArray utf8 = str.toUtf8();
+        if (utf8.contains(',') || utf8.contains('"') || utf8.contains('\n') || utf8.contains('\r')) {
+            QByteArray quoted = utf8;
+            quoted.replace('"', "\"\"");
+            m_buffer.append('"');
+            m_buffer.append(quoted);
+            m_buffer.append('"');
+        } else {
+            m_buffer.append(utf8);
+        }
+        flushIfFull();
+    }
+
+    bool flush()
+    {
+        if (m_ok && !m_buffer.isEmpty()) {
+            m_ok = m_file->write(m_buffer) == m_buffer.size();
+        }
+        m_buffer.resize(0);
+        return m_ok;
+    }
+
+    bool isOk() const
+    {
+        return m_ok;
+    }
+
+private:
+    void flushIfFull()
+    {
+        if (m_buffer.size() >= exportBufferSize) {
+            flush();
+        }
+    }
+
+    QFile *m_file;
+    QByteArray m_buffer;
+    bool m_ok;
+};
+
+QString displayPath(const QUrl &url)
+{
+    return url.isLocalFile() ? url.toLocalFile() : url.toDisplayString();
+}
+
+}
+
+KFindExportJob::KFindExportJob(const QList<KFindItem> &items, const QString &fileName, Format format, QObject *parent)
+    : KJob(parent)
+    , m_items(items)
+    , m_fileName(fileName)
+    , m_format(format)
+    , m_watcher(nullptr)
+{
+    m_progressTimer = new QTimer(this);
+    m_progressTimer->setInterval(100);
+    connect(m_progressTimer, &QTimer::timeout, this, &KFindExportJob::updateProgress);
+}
+
+KFindExportJob::~KFindExportJob()
+{
+    if (m_watcher) {
+        m_canceled.storeRelease(1);
+        m_watcher->waitForFinished();
+    }
+}
+
+void KFindExportJob::start()
+{
+    setTotalAmount(KJob::Files, m_items.size());
+
+    m_watcher = new QFutureWatcher<bool>(this);
+    connect(m_watcher, &QFutureWatcher<bool>::finished, this, &KFindExportJob::slotWriterFinished);
+    m_watcher->setFuture(QtConcurrent::run([this]() {
+        return writeResults();
+    }));
+    m_progressTimer->start();
+}
+
+bool KFindExportJob::doKill()
+{
+    m_canceled.storeRelease(1);
+    if (m_watcher) {
+        m_watcher->waitForFinished();
+    }
+    return true;
+}
+
+void KFindExportJob::updateProgress()
+{
+    const int written = m_written.loadAcquire();
+    setProcessedAmount(KJob::Files, written);
+    if (!m_items.isEmpty()) {
+        setPercent(100UL * written / m_items.size());
+    }
+}
+
+void KFindExportJob::slotWriterFinished()
+{
+    m_progressTimer->stop();
+    updateProgress();
+
+    if (!m_watcher->result()) {
+        setError(KJob::UserDefinedError);
+        setErrorText(m_writeError);
+    }
+    emitResult();
+}
+
+// Runs on a worker thread
+bool KFindExportJob::writeResults()
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        m_writeError = file.errorString();
+        return false;
+    }
+
+    ExportBuffer out(&file);
+    QTextCodec *codec = QTextCodec::codecForLocale();
+
+    switch (m_format) {
+    case Html:
+        out.append(codec->fromUnicode(QString::fromLatin1("<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\""
+                                                          "\"http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\"><html xmlns=\"http://www.w3.org/1999/xhtml\">\n"
+                                                          "<head>\n"
+                                                          "<title>%2</title></head>\n"
+                                                          "<meta charset=\"%1\">\n"
+                                                          "<body>\n<h1>%2</h1>\n"
+                                                          "<dl>\n")
+                                      .arg(QString::fromLatin1(codec->name()), i18n("KFind Results File"))));
+        break;
+    case Csv:
+        out.append("path,size,mtime,permissions,matching_line\r\n");
+        break;
+    default:
+        break;
+    }
+
+    for (const KFindItem &item : qAsConst(m_items)) {
+        if (m_canceled.loadAcquire()) {
+            break;
+        }
+
+        const QUrl url = item.url();
+        switch (m_format) {
+        case Html:
+            out.append("<dt><a href=\"");
+            out.append(codec->fromUnicode(url.url().toHtmlEscaped()));
+            out.append("\">");
+            out.append(codec->fromUnicode(url.toDisplayString().toHtmlEscaped()));
+            out.append("</a></dt>\n");
+            break;
+        case PlainText:
+            out.append(codec->fromUnicode(url.url()));
+            out.append('\n');
+            break;
+        case NulSeparated:
+            out.append(url.isLocalFile() ? QFile::encodeName(url.toLocalFile()) : url.toEncoded());
+            out.append('\0');
+            break;
+        case JsonLines:
+            out.append("{\"path\":");
+            out.appendJson(displayPath(url));
+            out.append(",\"size\":");
+            out.appendNumber(item.size());
+            out.append(",\"mtime\":");
+            out.appendNumber(item.modificationTime());
+            out.append(",\"permissions\":\"");
+            out.appendOctal(item.permissions() & 07777);
+            out.append("\",\"matchingLine\":");
+            out.appendJson(item.matchingLine());
+            if (const QSharedPointer<const KQueryMatches> matches = item.matches()) {
+                out.append(",\"matchCount\":");
+                out.appendNumber(matches->count);
+                out.append(",\"matches\":[");
+                for (int i = 0; i < matches->matches.size(); i++) {
+                    out.append(i ? ",{\"line\":" : "{\"line\":");
+                    out.appendNumber(matches->matches.at(i).line);
+                    out.append(",\"offset\":");
+                    out.appendNumber(matches->matches.at(i).offset);
+                    out.append('}');
+                }
+                out.append(']');
+            }
+            out.append("}\n");
+            break;
+        case Csv:
+            out.appendCsv(displayPath(url));
+            out.append(',');
+            out.appendNumber(item.size());
+            out.append(',');
+            out.appendNumber(item.modificationTime());
+            out.append(',');
+            out.appendOctal(item.permissions() & 07777);
+            out.append(',');
+            out.appendCsv(item.matchingLine());
+            out.append("\r\n");
+            break;
+        }
+
+        m_written.fetchAndAddRelaxed(1);
+    }
+
+    if (m_format == Html) {
+        out.append("</dl>\n</body>\n</html>\n");
+    }
+
+    if (!out.flush()) {
+        m_writeError = file.errorString();
+        return false;
+    }
+    return true;
+}
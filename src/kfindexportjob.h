@@ -0,0 +1,82 @@
+/*******************************************************************
+* kfindexportjob.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KFINDEXPORTJOB_H
+#define KFINDEXPORTJOB_H
+
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QList>
+#include <QString>
+
+#include <kjob.h>
+
+#include "kfindtreeview.h"
+
+class QTimer;
+
+/* Writes search results to a file on a worker thread.
+ * The rows are read straight from the (implicitly shared) model list and
+ * streamed through a large write buffer, so exporting huge result sets
+ * neither blocks the dialog nor flushes per line. */
+class KFindExportJob : public KJob
+{
+    Q_OBJECT
+
+public:
+    enum Format {
+        Html,
+        PlainText,
+        NulSeparated,   // local paths separated by '\0', for xargs -0
+        JsonLines,
+        Csv
+    };
+
+    KFindExportJob(const QList<KFindItem> &items, const QString &fileName, Format format, QObject *parent = nullptr);
+    ~KFindExportJob();
+
+    void start() Q_DECL_OVERRIDE;
+
+    QString fileName() const
+    {
+        return m_fileName;
+    }
+
+protected:
+    bool doKill() Q_DECL_OVERRIDE;
+
+private Q_SLOTS:
+    void updateProgress();
+    void slotWriterFinished();
+
+private:
+    bool writeResults();
+
+    QList<KFindItem> m_items;
+    QString m_fileName;
+    Format m_format;
+
+    QAtomicInt m_written;
+    QAtomicInt m_canceled;
+    QString m_writeError;
+
+    QFutureWatcher<bool> *m_watcher;
+    QTimer *m_progressTimer;
+};
+
+#endif
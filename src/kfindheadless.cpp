@@ -0,0 +1,416 @@
+/*******************************************************************
+* kfindheadless.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kfindheadless.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QTimer>
+
+#include <KLocalizedString>
+#include <kfileitem.h>
+#include <kio/global.h>
+
+#include "kquery.h"
+
+// File type names, in the order of KfindTabWidget's typeBox
+static const char *const fileTypes[] = {
+    "all", "file", "dir", "link", "special", "exec", "suid"
+};
+static const int fileTypeCount = sizeof(fileTypes) / sizeof(fileTypes[0]);
+
+/* Parses sizes like "100", "4K", "2M" or "1G" (binary units, as in the dialog) */
+static bool parseSize(const QString &text, KIO::filesize_t *size)
+{
+    QString number = text.trimmed();
+    KIO::filesize_t unit = 1;
+    if (!number.isEmpty()) {
+        switch (number.at(number.length() - 1).toUpper().toLatin1()) {
+        case 'K':
+            unit = 1024;
+            break;
+        case 'M':
+            unit = 1048576;
+            break;
+        case 'G':
+            unit = 1073741824;
+            break;
+        default:
+            break;
+        }
+        if (unit != 1) {
+            number.chop(1);
+        }
+    }
+
+    bool ok = false;
+    *size = number.toULongLong(&ok) * unit;
+    return ok;
+}
+
+static bool parseDate(const QString &text, QDate *date)
+{
+    *date = QDate::fromString(text, Qt::ISODate);
+    return date->isValid();
+}
+
+KFindHeadless::KFindHeadless(QObject *parent)
+    : QObject(parent)
+    , m_nullSeparated(false)
+    , m_printMatchingLine(false)
+    , m_printStatistics(false)
+    , m_found(false)
+{
+    m_query = new KQuery(this);
+    connect(m_query, &KQuery::foundFileList, this, &KFindHeadless::addFiles);
+    connect(m_query, &KQuery::result, this, &KFindHeadless::slotResult);
+
+    m_out.open(stdout, QIODevice::WriteOnly);
+}
+
+KFindHeadless::~KFindHeadless()
+{
+    m_out.flush();
+}
+
+bool KFindHeadless::isRequested(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (qstrcmp(argv[i], "--headless") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void KFindHeadless::addOptions(QCommandLineParser *parser)
+{
+    parser->addOption(QCommandLineOption(QStringLiteral("headless"), i18n("Search without showing the dialog and print the matches to standard output")));
+    parser->addOption(QCommandLineOption(QStringLiteral("name"), i18n("File name patterns, separated by \";\" (headless mode)"), i18n("patterns")));
+    parser->addOption(QCommandLineOption(QStringLiteral("case-sensitive"), i18n("Match file names case sensitively (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("no-recursive"), i18n("Do not search subfolders (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("min-depth"), i18n("Only files at least this many levels below the folder, 1 for its own files (headless mode)"), i18n("levels")));
+    parser->addOption(QCommandLineOption(QStringLiteral("max-depth"), i18n("Only files at most this many levels below the folder, deeper folders are not read (headless mode)"), i18n("levels")));
+    parser->addOption(QCommandLineOption(QStringLiteral("hidden"), i18n("Include hidden files (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("gitignore"), i18n("Skip what .gitignore, .ignore and .git/info/exclude files ignore (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("exclude-dir"), i18n("Folder names not to descend into, separated by \";\" (headless mode)"), i18n("patterns")));
+    parser->addOption(QCommandLineOption(QStringList() << QStringLiteral("L") << QStringLiteral("follow"), i18n("Follow symbolic links to folders (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("test-links"), i18n("Test the type of symbolic links themselves instead of their targets (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("duplicates"), i18n("Print the groups of files with equal content, separated by empty lines (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("collapse-hard-links"), i18n("Print a file reached by several paths once and search its contents once (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("xdev"), i18n("Do not descend into other file systems (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("mount-jobs"), i18n("Folders of one network mount listed at the same time, 1 by default (headless mode)"), i18n("count")));
+    parser->addOption(QCommandLineOption(QStringLiteral("mount-timeout"), i18n("Seconds a folder of a network mount may take to list before the mount is skipped, 30 by default, 0 for none (headless mode)"), i18n("seconds")));
+    parser->addOption(QCommandLineOption(QStringLiteral("locate"), i18n("Use the files index (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("archives"), i18n("Also search the files in zip and tar archives (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("type"), i18n("File type: all, file, dir, link, special, exec or suid (headless mode)"), i18n("type")));
+    parser->addOption(QCommandLineOption(QStringLiteral("mimetype"), i18n("MIME types, separated by \";\" (headless mode)"), i18n("types")));
+    parser->addOption(QCommandLineOption(QStringLiteral("min-size"), i18n("Minimum file size, with optional K, M or G suffix (headless mode)"), i18n("size")));
+    parser->addOption(QCommandLineOption(QStringLiteral("max-size"), i18n("Maximum file size, with optional K, M or G suffix (headless mode)"), i18n("size")));
+    parser->addOption(QCommandLineOption(QStringLiteral("modified-after"), i18n("Modified on or after this date, YYYY-MM-DD (headless mode)"), i18n("date")));
+    parser->addOption(QCommandLineOption(QStringLiteral("modified-before"), i18n("Modified on or before this date, YYYY-MM-DD (headless mode)"), i18n("date")));
+    parser->addOption(QCommandLineOption(QStringLiteral("modified-within"), i18n("Modified during the previous number of minutes (headless mode)"), i18n("minutes")));
+    parser->addOption(QCommandLineOption(QStringLiteral("user"), i18n("Files owned by user (headless mode)"), i18n("user")));
+    parser->addOption(QCommandLineOption(QStringLiteral("group"), i18n("Files owned by group (headless mode)"), i18n("group")));
+    parser->addOption(QCommandLineOption(QStringLiteral("contains"), i18n("Files containing this text (headless mode)"), i18n("text")));
+    parser->addOption(QCommandLineOption(QStringLiteral("content-case-sensitive"), i18n("Match the contained text case sensitively (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("binary"), i18n("Search the contents of binary files too (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("regexp"), i18n("The contained text is a regular expression (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("compressed"), i18n("Search the contained text in gzip, bzip2, xz and zstd compressed files too (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("metainfo"), i18n("Search file metainfo for this text (headless mode)"), i18n("text")));
+    parser->addOption(QCommandLineOption(QStringLiteral("metainfo-key"), i18n("Metainfo sections to search, wildcards allowed (headless mode)"), i18n("key"), QStringLiteral("*")));
+    parser->addOption(QCommandLineOption(QStringLiteral("checksum"), i18n("Files with this hexadecimal MD5, SHA-1 or SHA-256 checksum (headless mode)"), i18n("checksum")));
+    parser->addOption(QCommandLineOption(QStringLiteral("same-as"), i18n("Files with the same SHA-256 checksum as this file (headless mode)"), i18n("file")));
+    parser->addOption(QCommandLineOption(QStringLiteral("checksum-xattr"), i18n("Keep computed checksums in extended attributes of the files and trust those found there (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringList() << QStringLiteral("0") << QStringLiteral("null"), i18n("Separate printed paths with NUL characters instead of newlines (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("print-matching-line"), i18n("Print the first matching line after each path (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("all-matches"), i18n("Find every matching line of the contained text, printed one per line with --print-matching-line (headless mode)")));
+    parser->addOption(QCommandLineOption(QStringLiteral("context"), i18n("Lines printed around each match with --all-matches (headless mode)"), i18n("lines")));
+    parser->addOption(QCommandLineOption(QStringLiteral("max-results"), i18n("Stop after this many matches (headless mode)"), i18n("count")));
+    parser->addOption(QCommandLineOption(QStringLiteral("stats"), i18n("Print search statistics as JSON to standard error when done (headless mode)")));
+}
+
+bool KFindHeadless::setQuery(const QCommandLineParser &parser, const QUrl &url, QString *error)
+{
+    m_query->setPath(url);
+
+    const QString names = parser.value(QStringLiteral("name"));
+    m_query->setRegExp(names.isEmpty() ? QStringLiteral("*") : names, parser.isSet(QStringLiteral("case-sensitive")));
+    m_query->setRecursive(!parser.isSet(QStringLiteral("no-recursive")));
+    int minDepth = 1;
+    int maxDepth = -1;
+    if (parser.isSet(QStringLiteral("min-depth"))) {
+        bool ok;
+        minDepth = parser.value(QStringLiteral("min-depth")).toInt(&ok);
+        if (!ok || minDepth < 1) {
+            *error = i18n("Invalid depth: %1", parser.value(QStringLiteral("min-depth")));
+            return false;
+        }
+    }
+    if (parser.isSet(QStringLiteral("max-depth"))) {
+        bool ok;
+        maxDepth = parser.value(QStringLiteral("max-depth")).toInt(&ok);
+        if (!ok || maxDepth < minDepth) {
+            *error = i18n("Invalid depth: %1", parser.value(QStringLiteral("max-depth")));
+            return false;
+        }
+    }
+    m_query->setDepthRange(minDepth, maxDepth);
+    m_query->setShowHiddenFiles(parser.isSet(QStringLiteral("hidden")));
+    m_query->setUseIgnoreFiles(parser.isSet(QStringLiteral("gitignore")));
+    m_query->setExcludedFolders(parser.value(QStringLiteral("exclude-dir")).split(QLatin1Char(';'), QString::SkipEmptyParts));
+    m_query->setStayOnFilesystem(parser.isSet(QStringLiteral("xdev")));
+    m_query->setFollowSymlinks(parser.isSet(QStringLiteral("follow")));
+    m_query->setTestLinkTargets(!parser.isSet(QStringLiteral("test-links")));
+    m_query->setCollapseHardLinks(parser.isSet(QStringLiteral("collapse-hard-links")));
+    m_query->setFindDuplicates(parser.isSet(QStringLiteral("duplicates")));
+    int mountJobs = 1;
+    if (parser.isSet(QStringLiteral("mount-jobs"))) {
+        bool ok;
+        mountJobs = parser.value(QStringLiteral("mount-jobs")).toInt(&ok);
+        if (!ok || mountJobs < 1) {
+            *error = i18n("Invalid number of jobs: %1", parser.value(QStringLiteral("mount-jobs")));
+            return false;
+        }
+    }
+    int mountTimeout = 30;
+    if (parser.isSet(QStringLiteral("mount-timeout"))) {
+        bool ok;
+        mountTimeout = parser.value(QStringLiteral("mount-timeout")).toInt(&ok);
+        if (!ok || mountTimeout < 0) {
+            *error = i18n("Invalid timeout: %1", parser.value(QStringLiteral("mount-timeout")));
+            return false;
+        }
+    }
+    m_query->setNetworkMountLimits(mountJobs, mountTimeout);
+    m_query->setUseFileIndex(parser.isSet(QStringLiteral("locate")));
+    m_query->setSearchArchives(parser.isSet(QStringLiteral("archives")));
+
+    // size range, using the modes of KfindTabWidget's sizeBox
+    KIO::filesize_t minSize = 0;
+    KIO::filesize_t maxSize = 0;
+    const bool hasMin = parser.isSet(QStringLiteral("min-size"));
+    const bool hasMax = parser.isSet(QStringLiteral("max-size"));
+    if (hasMin && !parseSize(parser.value(QStringLiteral("min-size")), &minSize)) {
+        *error = i18n("Invalid size: %1", parser.value(QStringLiteral("min-size")));
+        return false;
+    }
+    if (hasMax && !parseSize(parser.value(QStringLiteral("max-size")), &maxSize)) {
+        *error = i18n("Invalid size: %1", parser.value(QStringLiteral("max-size")));
+        return false;
+    }
+    if (hasMin && hasMax) {
+        m_query->setSizeRange(minSize == maxSize ? 3 : 4, minSize, maxSize);
+    } else if (hasMin) {
+        m_query->setSizeRange(1, minSize, 0);
+    } else if (hasMax) {
+        m_query->setSizeRange(2, maxSize, 0);
+    } else {
+        m_query->setSizeRange(0, 0, 0);
+    }
+
+    // dates
+    QDateTime epoch;
+    epoch.setTime_t(0);
+    time_t timeFrom = 0;
+    time_t timeTo = 0;
+    if (parser.isSet(QStringLiteral("modified-after"))) {
+        QDate from;
+        if (!parseDate(parser.value(QStringLiteral("modified-after")), &from)) {
+            *error = i18n("Invalid date: %1", parser.value(QStringLiteral("modified-after")));
+            return false;
+        }
+        timeFrom = epoch.secsTo(QDateTime(from));
+    }
+    if (parser.isSet(QStringLiteral("modified-before"))) {
+        QDate to;
+        if (!parseDate(parser.value(QStringLiteral("modified-before")), &to)) {
+            *error = i18n("Invalid date: %1", parser.value(QStringLiteral("modified-before")));
+            return false;
+        }
+        timeTo = epoch.secsTo(QDateTime(to.addDays(1))) - 1; // Include the last day
+    }
+    if (parser.isSet(QStringLiteral("modified-within"))) {
+        if (parser.isSet(QStringLiteral("modified-after"))) {
+            *error = i18n("--modified-within and --modified-after cannot be combined");
+            return false;
+        }
+        bool ok = false;
+        const int minutes = parser.value(QStringLiteral("modified-within")).toInt(&ok);
+        if (!ok || minutes <= 0) {
+            *error = i18n("Invalid number of minutes: %1", parser.value(QStringLiteral("modified-within")));
+            return false;
+        }
+        timeFrom = time(nullptr) - time_t(minutes) * 60;
+    }
+    m_query->setTimeRange(timeFrom, timeTo);
+
+    m_query->setUsername(parser.value(QStringLiteral("user")));
+    m_query->setGroupname(parser.value(QStringLiteral("group")));
+
+    // file type; MIME types use the first type index after the special ones
+    int fileType = 0;
+    if (parser.isSet(QStringLiteral("type"))) {
+        const QString type = parser.value(QStringLiteral("type"));
+        fileType = -1;
+        for (int i = 0; i < fileTypeCount; i++) {
+            if (type == QLatin1String(fileTypes[i])) {
+                fileType = i;
+            }
+        }
+        if (fileType < 0) {
+            *error = i18n("Invalid file type: %1", type);
+            return false;
+        }
+    }
+    const QStringList mimeTypes = parser.value(QStringLiteral("mimetype")).split(QLatin1Char(';'), QString::SkipEmptyParts);
+    if (!mimeTypes.isEmpty()) {
+        fileType = fileTypeCount;
+    }
+    m_query->setFileType(fileType);
+    m_query->setMimeType(mimeTypes);
+
+    m_query->setMetaInfo(parser.value(QStringLiteral("metainfo")), parser.value(QStringLiteral("metainfo-key")));
+
+    // checksum; a reference file also tells the size of the files to read
+    QByteArray checksum;
+    QCryptographicHash::Algorithm algorithm = QCryptographicHash::Sha256;
+    qint64 checksumSize = -1;
+    if (parser.isSet(QStringLiteral("checksum"))
+        && !KQuery::parseChecksum(parser.value(QStringLiteral("checksum")), &checksum, &algorithm)) {
+        *error = i18n("Invalid checksum: %1", parser.value(QStringLiteral("checksum")));
+        return false;
+    }
+    if (parser.isSet(QStringLiteral("same-as"))) {
+        const QString reference = parser.value(QStringLiteral("same-as"));
+        algorithm = QCryptographicHash::Sha256;
+        checksumSize = QFileInfo(reference).size();
+        if (!QFileInfo(reference).isFile() || !KQueryContentScanner::checksum(reference, algorithm, &checksum)) {
+            *error = i18n("Cannot read the file: %1", reference);
+            return false;
+        }
+    }
+    m_query->setChecksum(checksum, algorithm, checksumSize);
+    m_query->setChecksumXattr(parser.isSet(QStringLiteral("checksum-xattr")));
+
+    m_query->setContext(parser.value(QStringLiteral("contains")), parser.isSet(QStringLiteral("content-case-sensitive")),
+                        parser.isSet(QStringLiteral("binary")), parser.isSet(QStringLiteral("regexp")));
+
+    int contextLines = 0;
+    if (parser.isSet(QStringLiteral("context"))) {
+        bool ok = false;
+        contextLines = parser.value(QStringLiteral("context")).toInt(&ok);
+        if (!ok || contextLines < 0) {
+            *error = i18n("Invalid number of context lines: %1", parser.value(QStringLiteral("context")));
+            return false;
+        }
+    }
+    m_query->setAllMatches(parser.isSet(QStringLiteral("all-matches")), contextLines);
+    m_query->setSearchCompressed(parser.isSet(QStringLiteral("compressed")));
+
+    if (parser.isSet(QStringLiteral("max-results"))) {
+        bool ok = false;
+        const int maxResults = parser.value(QStringLiteral("max-results")).toInt(&ok);
+        if (!ok || maxResults <= 0) {
+            *error = i18n("Invalid number of results: %1", parser.value(QStringLiteral("max-results")));
+            return false;
+        }
+        m_query->setMaxResults(maxResults);
+    }
+
+    m_nullSeparated = parser.isSet(QStringLiteral("null"));
+    m_printMatchingLine = parser.isSet(QStringLiteral("print-matching-line"));
+    m_printStatistics = parser.isSet(QStringLiteral("stats"));
+    return true;
+}
+
+int KFindHeadless::exec()
+{
+    QTimer::singleShot(0, m_query, &KQuery::start);
+    return QCoreApplication::exec();
+}
+
+void KFindHeadless::addFiles(const QList<KQueryResult> &results)
+{
+    for (const KQueryResult &result : results) {
+        const QUrl url = result.item.url();
+        const QByteArray path = url.isLocalFile() ? QFile::encodeName(url.toLocalFile()) : url.toEncoded();
+
+        // Like fdupes, an empty line between the groups
+        if (result.duplicates != m_lastGroup) {
+            if (m_lastGroup) {
+                m_out.write(m_nullSeparated ? "\0" : "\n", 1);
+            }
+            m_lastGroup = result.duplicates;
+        }
+
+        if (!m_printMatchingLine || result.matchingLine.isEmpty()) {
+            m_out.write(path);
+            m_out.write(m_nullSeparated ? "\0" : "\n", 1);
+            continue;
+        }
+
+        // Like grep, one output line per matching or context line
+        QStringList lines;
+        if (result.matches) {
+            const QStringList blocks = KQueryContentScanner::matchText(result.item, *result.matches);
+            for (const QString &block : blocks) {
+                lines += block.split(QLatin1Char('\n'));
+            }
+        }
+        if (lines.isEmpty()) {
+            lines.append(result.matchingLine);
+        }
+
+        for (const QString &line : qAsConst(lines)) {
+            m_out.write(path);
+            m_out.write(":", 1);
+            m_out.write(line.toLocal8Bit());
+            m_out.write(m_nullSeparated ? "\0" : "\n", 1);
+        }
+    }
+
+    if (!results.isEmpty()) {
+        m_found = true;
+        // stream the batch out right away instead of when stdio decides to
+        m_out.flush();
+    }
+}
+
+void KFindHeadless::slotResult(int errorCode)
+{
+    m_out.flush();
+
+    if (m_printStatistics) {
+        fprintf(stderr, "%s\n", m_query->statistics().toJson().constData());
+    }
+
+    if (errorCode != 0 && errorCode != KIO::ERR_USER_CANCELED) {
+        fprintf(stderr, "kfind: %s\n", qPrintable(KIO::buildErrorString(errorCode, m_query->url().toDisplayString())));
+        QCoreApplication::exit(2);
+        return;
+    }
+
+    QCoreApplication::exit(m_found ? 0 : 1);
+}
@@ -0,0 +1,71 @@
+/*******************************************************************
+* kfindheadless.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KFINDHEADLESS_H
+#define KFINDHEADLESS_H
+
+#include <QFile>
+#include <QObject>
+#include <QSharedPointer>
+#include <QUrl>
+
+class QCommandLineParser;
+class KQuery;
+struct KQueryDuplicateGroup;
+struct KQueryResult;
+
+/* Runs a single KQuery without any widgets and streams the
+ * matches to stdout, for use from scripts and benchmarks. */
+class KFindHeadless : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KFindHeadless(QObject *parent = nullptr);
+    ~KFindHeadless();
+
+    /* True if argv asks for headless mode; checked before any
+     * QApplication exists so that no GUI gets initialized */
+    static bool isRequested(int argc, char **argv);
+
+    static void addOptions(QCommandLineParser *parser);
+
+    /* Configures the query the same way KfindTabWidget::setQuery() does.
+     * Returns false and fills error if an option cannot be parsed. */
+    bool setQuery(const QCommandLineParser &parser, const QUrl &url, QString *error);
+
+    /* Runs the search, returns 0 if something was found, 1 if nothing
+     * was found and 2 on errors (like grep) */
+    int exec();
+
+private Q_SLOTS:
+    void addFiles(const QList<KQueryResult> &);
+    void slotResult(int);
+
+private:
+    KQuery *m_query;
+    QFile m_out;
+    bool m_nullSeparated;
+    bool m_printMatchingLine;
+    bool m_printStatistics;
+    bool m_found;
+    // Group of the last path printed in a duplicate search
+    QSharedPointer<const KQueryDuplicateGroup> m_lastGroup;
+};
+
+#endif
@@ -0,0 +1,267 @@
+/*******************************************************************
+* kfindtrace.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kfindtrace.h"
+#include "kfind_debug.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+
+// Events kept per ring, older ones are overwritten. The ring is allocated
+// a chunk at a time as it fills, so a pool thread that only traces a few
+// events takes a few KiB instead of the whole ring.
+static const int chunkSize = 1024;
+static const int chunkCount = 64;
+static const quint64 ringCapacity = quint64(chunkSize) * chunkCount;
+
+QAtomicInt KFindTrace::s_enabled;
+
+namespace {
+
+struct TraceEvent
+{
+    const char *name;
+    qint64 begin;
+    qint64 end;
+    qint64 arg;
+    // Rings are passed on to new threads, so each event names its own
+    quint64 threadId;
+};
+
+/* Used by one thread at a time */
+struct ThreadBuffer
+{
+    ~ThreadBuffer()
+    {
+        for (int i = 0; i < chunkCount; i++) {
+            delete[] chunks[i].load();
+        }
+    }
+
+    /* The slot of the event at index, for the owning thread */
+    TraceEvent &slot(quint64 index)
+    {
+        const int pos = int(index % ringCapacity);
+        TraceEvent *chunk = chunks[pos / chunkSize].load();
+        if (!chunk) {
+            chunk = new TraceEvent[chunkSize];
+            chunks[pos / chunkSize].storeRelease(chunk);
+        }
+        return chunk[pos % chunkSize];
+    }
+
+    /* For other threads, index must be below head */
+    const TraceEvent &at(quint64 index) const
+    {
+        const int pos = int(index % ringCapacity);
+        return chunks[pos / chunkSize].loadAcquire()[pos % chunkSize];
+    }
+
+    QAtomicPointer<TraceEvent> chunks[chunkCount];
+    // Only the owning thread writes; the slot is filled before head moves on
+    QAtomicInteger<quint64> head;
+};
+
+class Tracer
+{
+public:
+    QMutex mutex;
+    // Buffers are kept after their thread finished so its events get
+    // written. Pool threads come and go, the buffers of finished ones are
+    // taken by new ones, so there are never more than threads running.
+    QVector<ThreadBuffer *> buffers;
+    QVector<ThreadBuffer *> freeBuffers;
+    // By thread id, which the system reuses too
+    QHash<quint64, QByteArray> threadNames;
+    QString fileName;
+    QElapsedTimer clock;
+
+    ~Tracer()
+    {
+        qDeleteAll(buffers);
+    }
+};
+
+Q_GLOBAL_STATIC(Tracer, tracer)
+
+/* The buffer of the current thread, handed back when the thread ends */
+struct BufferLease
+{
+    BufferLease()
+        : buffer(nullptr)
+        , threadId(0)
+    {
+    }
+
+    ~BufferLease()
+    {
+        if (buffer && !tracer.isDestroyed()) {
+            Tracer *t = tracer();
+            QMutexLocker locker(&t->mutex);
+            t->freeBuffers.append(buffer);
+        }
+    }
+
+    ThreadBuffer *buffer;
+    quint64 threadId;
+};
+
+BufferLease *bufferLease()
+{
+    static thread_local BufferLease lease;
+    if (!lease.buffer) {
+        QThread *thread = QThread::currentThread();
+        QByteArray threadName = thread ? thread->objectName().toUtf8() : QByteArray();
+        if (threadName.isEmpty() && QCoreApplication::instance() && thread == QCoreApplication::instance()->thread()) {
+            threadName = "main";
+        }
+        lease.threadId = quint64(quintptr(QThread::currentThreadId()));
+
+        Tracer *t = tracer();
+        QMutexLocker locker(&t->mutex);
+        if (t->freeBuffers.isEmpty()) {
+            lease.buffer = new ThreadBuffer;
+            t->buffers.append(lease.buffer);
+        } else {
+            lease.buffer = t->freeBuffers.takeLast();
+        }
+        if (!threadName.isEmpty()) {
+            t->threadNames.insert(lease.threadId, threadName);
+        }
+    }
+    return &lease;
+}
+
+void writeNumber(QByteArray &out, qint64 value)
+{
+    out.append(QByteArray::number(value));
+}
+
+// Chrome expects microseconds
+void writeMicros(QByteArray &out, qint64 nanos)
+{
+    out.append(QByteArray::number(nanos / 1000));
+    out.append('.');
+    out.append(QByteArray::number(nanos % 1000).rightJustified(3, '0'));
+}
+
+}
+
+void KFindTrace::start(const QString &fileName)
+{
+    Tracer *t = tracer();
+    {
+        QMutexLocker locker(&t->mutex);
+        t->fileName = fileName;
+        t->clock.start();
+    }
+    s_enabled.store(1);
+    qAddPostRoutine(KFindTrace::stop);
+}
+
+qint64 KFindTrace::now()
+{
+    return tracer()->clock.nsecsElapsed();
+}
+
+void KFindTrace::complete(const char *name, qint64 begin, qint64 end, qint64 arg)
+{
+    BufferLease *lease = bufferLease();
+    ThreadBuffer *buffer = lease->buffer;
+    const quint64 head = buffer->head.load();
+    TraceEvent &event = buffer->slot(head);
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    event.arg = arg;
+    event.threadId = lease->threadId;
+    buffer->head.storeRelease(head + 1);
+}
+
+void KFindTrace::stop()
+{
+    if (!s_enabled.testAndSetOrdered(1, 0)) {
+        return;
+    }
+
+    Tracer *t = tracer();
+    QMutexLocker locker(&t->mutex);
+
+    QFile file(t->fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCWarning(KFING_LOG) << "Cannot write trace file" << t->fileName << file.errorString();
+        return;
+    }
+
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray out("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+
+    for (QHash<quint64, QByteArray>::const_iterator it = t->threadNames.constBegin(); it != t->threadNames.constEnd(); ++it) {
+        out.append(first ? "" : ",\n");
+        first = false;
+        out.append("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" + pid + ",\"tid\":"
+                   + QByteArray::number(it.key()) + ",\"args\":{\"name\":\"" + it.value() + "\"}}");
+    }
+
+    for (const ThreadBuffer *buffer : qAsConst(t->buffers)) {
+        // Pool threads can still be recording: copy the ring, then drop
+        // the events their owner may have overwritten meanwhile
+        const quint64 head = buffer->head.loadAcquire();
+        const quint64 begin = head > ringCapacity ? head - ringCapacity : 0;
+        QVector<TraceEvent> events;
+        events.reserve(int(head - begin));
+        for (quint64 i = begin; i < head; i++) {
+            events.append(buffer->at(i));
+        }
+        const quint64 lapped = buffer->head.loadAcquire();
+        const quint64 valid = lapped >= ringCapacity ? lapped - ringCapacity + 1 : 0;
+        const int dropped = valid > begin ? int(qMin(valid - begin, head - begin)) : 0;
+
+        for (int i = dropped; i < events.size(); i++) {
+            const TraceEvent &event = events.at(i);
+            out.append(first ? "" : ",\n");
+            first = false;
+            out.append("{\"ph\":\"X\",\"cat\":\"kfind\",\"name\":\"");
+            out.append(event.name);
+            out.append("\",\"pid\":" + pid + ",\"tid\":" + QByteArray::number(event.threadId) + ",\"ts\":");
+            writeMicros(out, event.begin);
+            out.append(",\"dur\":");
+            writeMicros(out, event.end - event.begin);
+            if (event.arg >= 0) {
+                out.append(",\"args\":{\"count\":");
+                writeNumber(out, event.arg);
+                out.append('}');
+            }
+            out.append('}');
+
+            if (out.size() > 1024 * 1024) {
+                file.write(out);
+                out.clear();
+            }
+        }
+    }
+
+    out.append("\n]}\n");
+    file.write(out);
+}
@@ -0,0 +1,86 @@
+/*******************************************************************
+* kfindtrace.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KFINDTRACE_H
+#define KFINDTRACE_H
+
+#include <QAtomicInt>
+#include <QString>
+
+/* Opt-in tracing of the search pipeline in Chrome trace-event format
+ * (load the file in chrome://tracing or ui.perfetto.dev).
+ *
+ * Every thread records into its own ring buffer of bounded size, so
+ * recording takes no locks and old events are dropped instead of growing
+ * memory. The ring of a finished thread is reused by the next new one. Events a thread overwrites while the trace is written are left
+ * out of it.
+ * When tracing is off a scope costs a single relaxed load. Event names
+ * must be string literals, they are stored by pointer. */
+class KFindTrace
+{
+public:
+    /* Enables tracing; the trace is written to fileName on exit */
+    static void start(const QString &fileName);
+    /* Writes the trace file and disables tracing */
+    static void stop();
+
+    static bool isEnabled()
+    {
+        return s_enabled.load();
+    }
+
+    /* Monotonic timestamp in nanoseconds */
+    static qint64 now();
+
+    /* Records an event lasting from begin to end; arg < 0 means none */
+    static void complete(const char *name, qint64 begin, qint64 end, qint64 arg = -1);
+
+    /* Records the lifetime of the scope as one event */
+    class Scope
+    {
+    public:
+        explicit Scope(const char *name, qint64 arg = -1)
+            : m_name(name)
+            , m_arg(arg)
+            , m_begin(KFindTrace::isEnabled() ? KFindTrace::now() : -1)
+        {
+        }
+
+        ~Scope()
+        {
+            if (m_begin >= 0) {
+                KFindTrace::complete(m_name, m_begin, KFindTrace::now(), m_arg);
+            }
+        }
+
+        void setArg(qint64 arg)
+        {
+            m_arg = arg;
+        }
+
+    private:
+        const char *m_name;
+        qint64 m_arg;
+        qint64 m_begin;
+    };
+
+private:
+    static QAtomicInt s_enabled;
+};
+
+#endif
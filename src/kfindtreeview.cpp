@@ -20,12 +20,14 @@
 #include "kfindtreeview.h"
 
 #include "kfinddlg.h"
+#include "kfindexportjob.h"
+#include "kfindtrace.h"
+#include "kqueryduplicates.h"
 
-#include <QTextStream>
-#include <QTextCodec>
 #include <QFileInfo>
 #include <QClipboard>
 #include <QHeaderView>
+#include <QAbstractItemDelegate>
 #include <QApplication>
 #include <QDate>
 #include <QMenu>
@@ -61,12 +63,19 @@ static const char *const perm[4] = {
 #define WO 2
 #define NA 3
 
+// Number of randomly chosen rows measured when sizing columns
+static const int columnSampleSize = 200;
+
 //BEGIN KFindItemModel
 
 KFindItemModel::KFindItemModel(KFindTreeView *parentView)
-    : QAbstractTableModel(parentView)
+    : QAbstractItemModel(parentView)
+    , m_showsDuplicates(false)
+    , m_sampledCount(0)
 {
     m_view = parentView;
+    m_longestRow[0] = m_longestRow[1] = -1;
+    m_longestLength[0] = m_longestLength[1] = 0;
 }
 
 QVariant KFindItemModel::headerData(int section, Qt::Orientation orientation, int role) const
@@ -84,6 +93,9 @@ QVariant KFindItemModel::headerData(int section, Qt::Orientation orientation, in
         case 4:
             return i18nc("file permissions column", "Permissions");
         case 5:
+            if (m_showsDuplicates) {
+                return i18nc("column describing the group of identical files a file belongs to", "Duplicates");
+            }
             return i18nc("first matching line of the query string in this file", "First Matching Line");
         default:
             return QVariant();
@@ -92,38 +104,118 @@ QVariant KFindItemModel::headerData(int section, Qt::Orientation orientation, in
     return QVariant();
 }
 
-void KFindItemModel::insertFileItems(const QList< QPair<KFileItem, QString> > &pairs)
+void KFindItemModel::insertFileItems(const QList<KQueryResult> &results)
 {
-    if (pairs.size() > 0) {
-        beginInsertRows(QModelIndex(), m_itemList.size(), m_itemList.size()+pairs.size()-1);
+    KFindTrace::Scope trace("insertFileItems", results.size());
+    if (!m_showsDuplicates && !results.isEmpty() && results.first().duplicates) {
+        m_showsDuplicates = true;
+        emit headerDataChanged(Qt::Horizontal, 5, 5);
+    }
+
+    if (results.size() > 0) {
+        beginInsertRows(QModelIndex(), m_itemList.size(), m_itemList.size()+results.size()-1);
 
-        QList< QPair<KFileItem, QString> >::const_iterator it = pairs.constBegin();
-        QList< QPair<KFileItem, QString> >::const_iterator end = pairs.constEnd();
+        QList<KQueryResult>::const_iterator it = results.constBegin();
+        QList<KQueryResult>::const_iterator end = results.constEnd();
 
         for (; it != end; ++it) {
-            QPair<KFileItem, QString> pair = *it;
+            const KQueryResult &result = *it;
 
-            QString subDir = m_view->reducedDir(pair.first.url().adjusted(QUrl::RemoveFilename).path());
-            m_itemList.append(KFindItem(pair.first, subDir, pair.second));
+            QString subDir = m_view->reducedDir(result.item.url().adjusted(QUrl::RemoveFilename).path());
+            sampleRow(m_itemList.size(), result.item.url().fileName().length(), subDir.length());
+            if (result.matches) {
+                m_matchRows.insert(result.matches.data(), m_itemList.size());
+            }
+            m_itemList.append(KFindItem(result.item, subDir, result.matchingLine, result.matches, result.otherLinks,
+                                        result.duplicates));
         }
 
         endInsertRows();
     }
 }
 
+void KFindItemModel::sampleRow(int row, int nameLength, int subDirLength)
+{
+    // Reservoir sampling keeps a uniform sample of every row seen so far
+    m_sampledCount++;
+    if (m_sampleRows.size() < columnSampleSize) {
+        m_sampleRows.append(row);
+    } else {
+        const int slot = qrand() % m_sampledCount;
+        if (slot < columnSampleSize) {
+            m_sampleRows[slot] = row;
+        }
+    }
+
+    if (nameLength > m_longestLength[0]) {
+        m_longestLength[0] = nameLength;
+        m_longestRow[0] = row;
+    }
+    if (subDirLength > m_longestLength[1]) {
+        m_longestLength[1] = subDirLength;
+        m_longestRow[1] = row;
+    }
+}
+
+QVector<int> KFindItemModel::sampledRows() const
+{
+    QVector<int> rows = m_sampleRows;
+    for (int i = 0; i < 2; i++) {
+        if (m_longestRow[i] >= 0) {
+            rows.append(m_longestRow[i]);
+        }
+    }
+    return rows;
+}
+
+QModelIndex KFindItemModel::index(int row, int column, const QModelIndex &parent) const
+{
+    if (row < 0 || column < 0 || column >= columnCount() || row >= rowCount(parent)) {
+        return QModelIndex();
+    }
+
+    if (!parent.isValid()) {
+        return createIndex(row, column);
+    }
+
+    //Match rows point to the matches of their file
+    const KQueryMatches *matches = m_itemList.at(parent.row()).matches().data();
+    return createIndex(row, column, const_cast<KQueryMatches *>(matches));
+}
+
+QModelIndex KFindItemModel::parent(const QModelIndex &index) const
+{
+    if (!isMatchIndex(index)) {
+        return QModelIndex();
+    }
+
+    const int row = m_matchRows.value(static_cast<const KQueryMatches *>(index.internalPointer()), -1);
+    return row >= 0 ? createIndex(row, 0) : QModelIndex();
+}
+
 int KFindItemModel::rowCount(const QModelIndex &parent) const
 {
     if (!parent.isValid()) {
         return m_itemList.count(); //Return itemcount for toplevel
-    } else {
+    }
+    if (isMatchIndex(parent) || parent.column() != 0) {
+        return 0;
+    }
+
+    const QSharedPointer<const KQueryMatches> matches = m_itemList.at(parent.row()).matches();
+    if (!matches) {
         return 0;
     }
+    //One more row tells how many matches were not stored
+    const int stored = matches->matches.size();
+    return matches->count > stored ? stored + 1 : stored;
 }
 
 KFindItem KFindItemModel::itemAtIndex(const QModelIndex &index) const
 {
-    if (index.isValid() && m_itemList.size() >= index.row()) {
-        return m_itemList.at(index.row());
+    const QModelIndex fileIndex = isMatchIndex(index) ? parent(index) : index;
+    if (fileIndex.isValid() && fileIndex.row() < m_itemList.size()) {
+        return m_itemList.at(fileIndex.row());
     }
 
     return KFindItem();
@@ -135,6 +227,10 @@ QVariant KFindItemModel::data(const QModelIndex &index, int role) const
         return QVariant();
     }
 
+    if (isMatchIndex(index)) {
+        return matchData(index, role);
+    }
+
     if (index.column() > 6 || index.row() >= m_itemList.count()) {
         return QVariant();
     }
@@ -150,6 +246,43 @@ QVariant KFindItemModel::data(const QModelIndex &index, int role) const
     return QVariant();
 }
 
+QVariant KFindItemModel::matchData(const QModelIndex &index, int role) const
+{
+    const KQueryMatches *matches = static_cast<const KQueryMatches *>(index.internalPointer());
+    const int fileRow = m_matchRows.value(matches, -1);
+    if (fileRow < 0) {
+        return QVariant();
+    }
+
+    if (index.row() >= matches->matches.size()) {
+        if (role == Qt::DisplayRole && index.column() == 0) {
+            const int more = matches->count - matches->matches.size();
+            return i18ncp("matches of the search text that are not listed", "1 more match", "%1 more matches", more);
+        }
+        return QVariant();
+    }
+
+    const KQueryMatch &match = matches->matches.at(index.row());
+    switch (role) {
+    case Qt::DisplayRole:
+        if (index.column() == 0) {
+            return i18nc("line of a file with a match", "Line %1", match.line);
+        }
+        if (index.column() == 5) {
+            QHash<const KQueryMatches *, QStringList>::iterator texts = m_matchTexts.find(matches);
+            if (texts == m_matchTexts.end()) {
+                texts = m_matchTexts.insert(matches, KQueryContentScanner::matchText(m_itemList.at(fileRow).getFileItem(), *matches));
+            }
+            return texts->value(index.row());
+        }
+        return QVariant();
+    case Qt::ToolTipRole:
+        return i18nc("position of a matching line in its file", "Byte offset %1", match.offset);
+    default:
+        return QVariant();
+    }
+}
+
 void KFindItemModel::removeItem(const QUrl &url)
 {
     int itemCount = m_itemList.size();
@@ -158,12 +291,45 @@ void KFindItemModel::removeItem(const QUrl &url)
         if (item.getFileItem().url() == url) {
             beginRemoveRows(QModelIndex(), i, i);
             m_itemList.removeAt(i);
+
+            m_matchRows.remove(item.matches().data());
+            m_matchTexts.remove(item.matches().data());
+            for (QHash<const KQueryMatches *, int>::iterator it = m_matchRows.begin(); it != m_matchRows.end(); ++it) {
+                if (*it > i) {
+                    (*it)--;
+                }
+            }
+
+            // Keep the sampled rows pointing at the same items
+            for (int j = m_sampleRows.size() - 1; j >= 0; j--) {
+                if (m_sampleRows.at(j) == i) {
+                    m_sampleRows.remove(j);
+                } else if (m_sampleRows.at(j) > i) {
+                    m_sampleRows[j]--;
+                }
+            }
+            for (int j = 0; j < 2; j++) {
+                if (m_longestRow[j] == i) {
+                    m_longestRow[j] = -1;
+                    m_longestLength[j] = 0;
+                } else if (m_longestRow[j] > i) {
+                    m_longestRow[j]--;
+                }
+            }
+
             endRemoveRows();
             return;
         }
     }
 }
 
+void KFindItemModel::updateOtherLinks()
+{
+    if (!m_itemList.isEmpty()) {
+        emit dataChanged(index(0, 0), index(m_itemList.size() - 1, 0));
+    }
+}
+
 bool KFindItemModel::isInserted(const QUrl &url)
 {
     int itemCount = m_itemList.size();
@@ -180,13 +346,24 @@ void KFindItemModel::clear()
 {
     beginRemoveRows(QModelIndex(), 0, m_itemList.size());
     m_itemList.clear();
+    m_matchRows.clear();
+    m_matchTexts.clear();
+    m_sampleRows.clear();
+    m_sampledCount = 0;
+    m_longestRow[0] = m_longestRow[1] = -1;
+    m_longestLength[0] = m_longestLength[1] = 0;
     endRemoveRows();
+
+    if (m_showsDuplicates) {
+        m_showsDuplicates = false;
+        emit headerDataChanged(Qt::Horizontal, 5, 5);
+    }
 }
 
 Qt::ItemFlags KFindItemModel::flags(const QModelIndex &index) const
 {
     Qt::ItemFlags defaultFlags = Qt::ItemIsSelectable | Qt::ItemIsEnabled;
-    if (index.isValid()) {
+    if (index.isValid() && !isMatchIndex(index)) {
         return Qt::ItemIsDragEnabled | defaultFlags;
     }
     return defaultFlags;
@@ -197,7 +374,7 @@ QMimeData *KFindItemModel::mimeData(const QModelIndexList &indexes) const
     QList<QUrl> uris;
 
     foreach (const QModelIndex &index, indexes) {
-        if (index.isValid()) {
+        if (index.isValid() && !isMatchIndex(index)) {
             if (index.column() == 0) { //Only use the first column item
                 uris.append(m_itemList.at(index.row()).getFileItem().url());
             }
@@ -218,12 +395,27 @@ QMimeData *KFindItemModel::mimeData(const QModelIndexList &indexes) const
 
 //BEGIN KFindItem
 
-KFindItem::KFindItem(const KFileItem &_fileItem, const QString &subDir, const QString &matchingLine)
+KFindItem::KFindItem(const KFileItem &_fileItem, const QString &subDir, const QString &matchingLine,
+                     const QSharedPointer<const KQueryMatches> &matches, const QSharedPointer<const int> &otherLinks,
+                     const QSharedPointer<const KQueryDuplicateGroup> &duplicates)
+    : m_matches(matches)
+    , m_otherLinks(otherLinks)
+    , m_duplicates(duplicates)
+    , m_size(0)
+    , m_mtime(0)
+    , m_mode(0)
 {
     m_fileItem = _fileItem;
     m_subDir = subDir;
     m_matchingLine = matchingLine;
 
+    if (!m_fileItem.isNull()) {
+        m_url = m_fileItem.url();
+        m_size = m_fileItem.size();
+        m_mtime = m_fileItem.time(KFileItem::ModificationTime).toTime_t();
+        m_mode = m_fileItem.permissions();
+    }
+
     //TODO more caching ?
     if (!m_fileItem.isNull() && m_fileItem.isLocalFile()) {
         QFileInfo fileInfo(m_fileItem.url().toLocalFile());
@@ -258,16 +450,26 @@ QVariant KFindItem::data(int column, int role) const
     if (role == Qt::DisplayRole) {
         switch (column) {
         case 0:
-            return m_fileItem.url().fileName();
+            if (m_otherLinks && *m_otherLinks > 0) {
+                return i18ncp("%2 is a file name, %1 the number of other paths to the same file",
+                              "%2 (also at 1 other path)", "%2 (also at %1 other paths)", *m_otherLinks, m_url.fileName());
+            }
+            return m_url.fileName();
         case 1:
             return m_subDir;
         case 2:
-            return KIO::convertSize(m_fileItem.size());
+            return KIO::convertSize(m_size);
         case 3:
             return m_fileItem.timeString(KFileItem::ModificationTime);
         case 4:
             return m_permission;
         case 5:
+            if (m_duplicates) {
+                return i18ncp("%2 numbers the groups of identical files, %3 is a size",
+                              "Group %2: 1 copy, %3 reclaimable", "Group %2: %1 copies, %3 reclaimable",
+                              m_duplicates->paths.size(), m_duplicates->number,
+                              KIO::convertSize(m_duplicates->reclaimable()));
+            }
             return m_matchingLine;
         default:
             return QVariant();
@@ -277,9 +479,15 @@ QVariant KFindItem::data(int column, int role) const
     if (role == Qt::UserRole) {
         switch (column) {
         case 2:
-            return m_fileItem.size();
+            return m_size;
         case 3:
-            return m_fileItem.time(KFileItem::ModificationTime).toTime_t();
+            return m_mtime;
+        case 5:
+            // Keeps the copies together when sorted by group
+            if (m_duplicates) {
+                return m_duplicates->number;
+            }
+            return QVariant();
         default:
             return QVariant();
         }
@@ -294,16 +502,26 @@ QVariant KFindItem::data(int column, int role) const
 
 bool KFindSortFilterProxyModel::lessThan(const QModelIndex &left, const QModelIndex &right) const
 {
+    //Matching lines stay in file order
+    if (KFindItemModel::isMatchIndex(left)) {
+        return left.row() < right.row();
+    }
     //Order by UserData size in bytes or unix date
     if (left.column() == 2 || left.column() == 3) {
         qulonglong leftData = sourceModel()->data(left, Qt::UserRole).toULongLong();
         qulonglong rightData = sourceModel()->data(right, Qt::UserRole).toULongLong();
         return leftData < rightData;
     }
-    // Default sorting rules for string values
-    else {
-        return QSortFilterProxyModel::lessThan(left, right);
+    //Duplicate files by their group
+    if (left.column() == 5) {
+        const QVariant leftGroup = sourceModel()->data(left, Qt::UserRole);
+        const QVariant rightGroup = sourceModel()->data(right, Qt::UserRole);
+        if (leftGroup.isValid() && rightGroup.isValid()) {
+            return leftGroup.toInt() < rightGroup.toInt();
+        }
     }
+    // Default sorting rules for string values
+    return QSortFilterProxyModel::lessThan(left, right);
 }
 
 //END KFindSortFilterProxyModel
@@ -315,6 +533,14 @@ KFindTreeView::KFindTreeView(QWidget *parent, KfindDlg *findDialog)
     , m_contextMenu(Q_NULLPTR)
     , m_kfindDialog(findDialog)
 {
+    //Column widths are refreshed from a sample while results stream in
+    m_resizeTimer = new QTimer(this);
+    m_resizeTimer->setSingleShot(true);
+    m_resizeTimer->setInterval(500);
+    connect(m_resizeTimer, &QTimer::timeout, this, [this]() {
+        resizeToContents(true);
+    });
+
     //Configure model and proxy model
     m_model = new KFindItemModel(this);
     m_proxyModel = new KFindSortFilterProxyModel();
@@ -372,12 +598,39 @@ KFindTreeView::~KFindTreeView()
     delete m_actionCollection;
 }
 
-void KFindTreeView::resizeToContents()
+void KFindTreeView::resizeToContents(bool growOnly)
 {
-    resizeColumnToContents(0);
-    resizeColumnToContents(1);
-    resizeColumnToContents(2);
-    resizeColumnToContents(3);
+    // Measuring every row freezes the view on large result sets, so only
+    // the visible rows and a bounded sample of the model are measured
+    QModelIndexList indexes;
+
+    QModelIndex visible = indexAt(viewport()->rect().topLeft());
+    const int bottom = viewport()->rect().bottom();
+    while (visible.isValid() && visualRect(visible).top() <= bottom) {
+        indexes.append(visible);
+        visible = indexBelow(visible);
+    }
+
+    const QVector<int> rows = m_model->sampledRows();
+    for (int row : rows) {
+        if (row < m_model->rowCount()) {
+            indexes.append(m_proxyModel->mapFromSource(m_model->index(row, 0)));
+        }
+    }
+
+    const QStyleOptionViewItem option = viewOptions();
+    for (int column = 0; column < 4; column++) {
+        int width = header()->sectionSizeHint(column);
+        for (const QModelIndex &rowIndex : qAsConst(indexes)) {
+            const QModelIndex index = rowIndex.sibling(rowIndex.row(), column);
+            if (index.isValid()) {
+                width = qMax(width, itemDelegate(index)->sizeHint(option, index).width());
+            }
+        }
+        if (!growOnly || width > columnWidth(column)) {
+            setColumnWidth(column, width);
+        }
+    }
 }
 
 QString KFindTreeView::reducedDir(const QString &fullDir)
@@ -393,16 +646,37 @@ void KFindTreeView::beginSearch(const QUrl &baseUrl)
 {
     m_baseDir = QDir(baseUrl.toLocalFile());
     m_model->clear();
+    setRootIsDecorated(false);
 }
 
 void KFindTreeView::endSearch()
 {
+    m_resizeTimer->stop();
     resizeToContents();
 }
 
-void KFindTreeView::insertItems(const QList< QPair<KFileItem, QString> > &pairs)
+void KFindTreeView::insertItems(const QList<KQueryResult> &results)
+{
+    m_model->insertFileItems(results);
+
+    //Files with their matching lines as children can be expanded
+    if (!rootIsDecorated()) {
+        for (const KQueryResult &result : results) {
+            if (result.matches) {
+                setRootIsDecorated(true);
+                break;
+            }
+        }
+    }
+
+    if (!m_resizeTimer->isActive()) {
+        m_resizeTimer->start();
+    }
+}
+
+void KFindTreeView::updateOtherLinks()
 {
-    m_model->insertFileItems(pairs);
+    m_model->updateOtherLinks();
 }
 
 void KFindTreeView::removeItem(const QUrl &url)
@@ -433,10 +707,22 @@ void KFindTreeView::saveResults()
     QFileDialog dialog;
     dialog.setAcceptMode(QFileDialog::AcceptSave);
     dialog.setWindowTitle(i18nc("@title:window", "Save Results As"));
-    dialog.setMimeTypeFilters({
-        QStringLiteral("text/html"),
-        QStringLiteral("text/plain")
-    });
+
+    const QStringList filters = {
+        i18n("HTML page (*.html *.htm)"),
+        i18n("Plain text (*.txt)"),
+        i18n("NUL-separated paths (*)"),
+        i18n("JSON Lines (*.jsonl)"),
+        i18n("CSV (*.csv)")
+    };
+    const KFindExportJob::Format formats[] = {
+        KFindExportJob::Html,
+        KFindExportJob::PlainText,
+        KFindExportJob::NulSeparated,
+        KFindExportJob::JsonLines,
+        KFindExportJob::Csv
+    };
+    dialog.setNameFilters(filters);
 
     if (!dialog.exec()) {
         return;
@@ -451,42 +737,24 @@ void KFindTreeView::saveResults()
         return;
     }
 
-    QString filename = u.toLocalFile();
+    const int filterIndex = qMax(0, filters.indexOf(dialog.selectedNameFilter()));
 
-    QFile file(filename);
+    KFindExportJob *exportJob = new KFindExportJob(m_model->getItemList(), u.toLocalFile(), formats[filterIndex], this);
+    connect(exportJob, &KJob::percent, this, [this](KJob *, unsigned long percent) {
+        m_kfindDialog->setStatusMsg(i18nc("%1=percentage", "Saving results... %1%", percent));
+    });
+    connect(exportJob, &KJob::result, this, &KFindTreeView::slotExportResult);
+    exportJob->start();
+}
 
-    if (!file.open(QIODevice::WriteOnly)) {
+void KFindTreeView::slotExportResult(KJob *job)
+{
+    if (job->error()) {
         KMessageBox::error(parentWidget(),
                            i18n("Unable to save results."));
+        m_kfindDialog->setStatusMsg(job->errorText());
     } else {
-        QTextStream stream(&file);
-        stream.setCodec(QTextCodec::codecForLocale());
-
-        const QList<KFindItem> itemList = m_model->getItemList();
-        if (dialog.selectedMimeTypeFilter() == QLatin1String("text/html")) {
-            stream << QString::fromLatin1("<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\""
-                                          "\"http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\"><html xmlns=\"http://www.w3.org/1999/xhtml\">\n"
-                                          "<head>\n"
-                                          "<title>%2</title></head>\n"
-                                          "<meta charset=\"%1\">\n"
-                                          "<body>\n<h1>%2</h1>\n"
-                                          "<dl>\n")
-                .arg(QString::fromLatin1(QTextCodec::codecForLocale()->name()))
-                .arg(i18n("KFind Results File"));
-
-            for (const KFindItem &item : itemList) {
-                const KFileItem fileItem = item.getFileItem();
-                stream << QStringLiteral("<dt><a href=\"%1\">%2</a></dt>\n").arg(
-                    fileItem.url().url(), fileItem.url().toDisplayString());
-            }
-            stream << QStringLiteral("</dl>\n</body>\n</html>\n");
-        } else {
-            for (const KFindItem &item : itemList) {
-                stream << item.getFileItem().url().url() << endl;
-            }
-        }
-
-        file.close();
+        const QString filename = static_cast<KFindExportJob *>(job)->fileName();
         m_kfindDialog->setStatusMsg(i18nc("%1=filename", "Results were saved to: %1", filename));
     }
 }
@@ -543,7 +811,7 @@ void KFindTreeView::contextMenuRequested(const QPoint &p)
     }
 
     Q_FOREACH (const QModelIndex &index, selected) {
-        if (index.column() == 0) {
+        if (index.column() == 0 && !KFindItemModel::isMatchIndex(index)) {
             const KFindItem item = m_model->itemAtIndex(index);
             if (item.isValid()) {
                 fileList.append(item.getFileItem());
@@ -591,7 +859,7 @@ QList<QUrl> KFindTreeView::selectedUrls()
 
     const QModelIndexList indexes = m_proxyModel->mapSelectionToSource(selectionModel()->selection()).indexes();
     Q_FOREACH (const QModelIndex &index, indexes) {
-        if (index.column() == 0 && index.isValid()) {
+        if (index.column() == 0 && index.isValid() && !KFindItemModel::isMatchIndex(index)) {
             KFindItem item = m_model->itemAtIndex(index);
             if (item.isValid()) {
                 uris.append(item.getFileItem().url());
@@ -22,15 +22,22 @@
 
 #include <kfileitem.h>
 
-#include <QAbstractTableModel>
+#include <QAbstractItemModel>
 #include <QDir>
 #include <QDragMoveEvent>
+#include <QHash>
 #include <QIcon>
+#include <QSharedPointer>
 #include <QSortFilterProxyModel>
+#include <QTimer>
 #include <QTreeView>
 #include <QUrl>
+#include <QVector>
+
+#include "kquerycontent.h"
 
 class QMenu;
+class KJob;
 class KFindTreeView;
 class KActionCollection;
 class KfindDlg;
@@ -38,7 +45,10 @@ class KfindDlg;
 class KFindItem
 {
 public:
-    explicit KFindItem(const KFileItem & = KFileItem(), const QString &subDir = QString(), const QString &matchingLine = QString());
+    explicit KFindItem(const KFileItem & = KFileItem(), const QString &subDir = QString(), const QString &matchingLine = QString(),
+                       const QSharedPointer<const KQueryMatches> &matches = QSharedPointer<const KQueryMatches>(),
+                       const QSharedPointer<const int> &otherLinks = QSharedPointer<const int>(),
+                       const QSharedPointer<const KQueryDuplicateGroup> &duplicates = QSharedPointer<const KQueryDuplicateGroup>());
 
     QVariant data(int column, int role) const;
 
@@ -52,25 +62,70 @@ public:
         return !m_fileItem.isNull();
     }
 
+    /* Values cached at insertion, safe to read from the export thread */
+    QUrl url() const
+    {
+        return m_url;
+    }
+
+    KIO::filesize_t size() const
+    {
+        return m_size;
+    }
+
+    uint modificationTime() const
+    {
+        return m_mtime;
+    }
+
+    mode_t permissions() const
+    {
+        return m_mode;
+    }
+
+    QString matchingLine() const
+    {
+        return m_matchingLine;
+    }
+
+    /* Null unless all matches were collected */
+    QSharedPointer<const KQueryMatches> matches() const
+    {
+        return m_matches;
+    }
+
 private:
     KFileItem m_fileItem;
+    QUrl m_url;
+    KIO::filesize_t m_size;
+    uint m_mtime;
+    mode_t m_mode;
     QString m_matchingLine;
+    QSharedPointer<const KQueryMatches> m_matches;
+    // Grows while the search runs, see KQueryResult
+    QSharedPointer<const int> m_otherLinks;
+    QSharedPointer<const KQueryDuplicateGroup> m_duplicates;
     QString m_subDir;
     QString m_permission;
     QIcon m_icon;
 };
 
-class KFindItemModel : public QAbstractTableModel
+/* The found files, with their matching lines as children when all
+ * matches were collected. A match row points to the KQueryMatches of its
+ * file, the text of the lines is read when they are first shown. */
+class KFindItemModel : public QAbstractItemModel
 {
 public:
     explicit KFindItemModel(KFindTreeView *parent);
 
-    void insertFileItems(const QList< QPair<KFileItem, QString> > &);
+    void insertFileItems(const QList<KQueryResult> &);
 
     void removeItem(const QUrl &);
     bool isInserted(const QUrl &);
 
     void clear();
+    /* The other link counts of the items changed */
+    void updateOtherLinks();
 
     Qt::DropActions supportedDropActions() const Q_DECL_OVERRIDE
     {
@@ -86,20 +141,49 @@ public:
         return 6;
     }
 
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    QModelIndex parent(const QModelIndex &index) const Q_DECL_OVERRIDE;
     int rowCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const Q_DECL_OVERRIDE;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const Q_DECL_OVERRIDE;
 
+    /* For a match row, the file it is in */
     KFindItem itemAtIndex(const QModelIndex &index) const;
 
+    static bool isMatchIndex(const QModelIndex &index)
+    {
+        return index.internalPointer() != nullptr;
+    }
+
+    /* Implicitly shared, so this does not copy the rows */
     QList<KFindItem> getItemList() const
     {
         return m_itemList;
     }
 
+    /* Rows worth measuring when sizing columns: a random sample of all
+     * inserted rows plus the rows holding the longest name and folder */
+    QVector<int> sampledRows() const;
+
 private:
+    void sampleRow(int row, int nameLength, int subDirLength);
+    QVariant matchData(const QModelIndex &index, int role) const;
+
     QList<KFindItem> m_itemList;
     KFindTreeView *m_view;
+
+    // Row of the file each match list belongs to
+    QHash<const KQueryMatches *, int> m_matchRows;
+    // Texts of the match lists shown so far
+    mutable QHash<const KQueryMatches *, QStringList> m_matchTexts;
+
+    // The last column describes the group of copies instead of a match
+    bool m_showsDuplicates;
+
+    QVector<int> m_sampleRows;
+    int m_sampledCount;
+    int m_longestRow[2];
+    int m_longestLength[2];
 };
 
 class KFindSortFilterProxyModel : public QSortFilterProxyModel
@@ -126,8 +210,9 @@ public:
     void beginSearch(const QUrl &baseUrl);
     void endSearch();
 
-    void insertItems(const QList< QPair<KFileItem, QString> > &);
+    void insertItems(const QList<KQueryResult> &);
     void removeItem(const QUrl &url);
+    void updateOtherLinks();
 
     bool isInserted(const QUrl &url)
     {
@@ -160,6 +245,8 @@ private Q_SLOTS:
     void reconfigureMouseSettings();
     void updateMouseButtons();
 
+    void slotExportResult(KJob *job);
+
 protected:
     void dragMoveEvent(QDragMoveEvent *e) Q_DECL_OVERRIDE
     {
@@ -170,7 +257,7 @@ Q_SIGNALS:
     void resultSelected(bool);
 
 private:
-    void resizeToContents();
+    void resizeToContents(bool growOnly = false);
 
     QDir m_baseDir;
 
@@ -178,6 +265,7 @@ private:
     KFindSortFilterProxyModel *m_proxyModel;
     KActionCollection *m_actionCollection;
     QMenu *m_contextMenu;
+    QTimer *m_resizeTimer;
 
     Qt::MouseButtons m_mouseButtons;
 
@@ -25,6 +25,7 @@
 #include <QCheckBox>
 #include <QMimeDatabase>
 #include <QWhatsThis>
+#include <QFileInfo>
 
 #include <QPushButton>
 #include <QApplication>
@@ -94,17 +95,53 @@ KfindTabWidget::KfindTabWidget(QWidget *parent)
     QLabel *lookinL = new QLabel(i18n("Look &in:"), pages[0]);
     lookinL->setBuddy(dirBox);
     lookinL->setObjectName(QStringLiteral("lookin"));
+    excludeBox = new KComboBox(pages[0]);
+    excludeBox->setEditable(true);
+    excludeBox->setSizePolicy(QSizePolicy::Preferred, QSizePolicy::Fixed);
+    QLabel *excludeL = new QLabel(i18n("E&xclude folders:"), pages[0]);
+    excludeL->setBuddy(excludeBox);
+    excludeL->setToolTip(i18n("Folders not to look in, you can use wildcard matching and \";\" for separating multiple names"));
     subdirsCb = new QCheckBox(i18n("Include &subfolders"), pages[0]);
     caseSensCb = new QCheckBox(i18n("Case s&ensitive search"), pages[0]);
     browseB = new QPushButton(i18n("&Browse..."), pages[0]);
     useLocateCb = new QCheckBox(i18n("&Use files index"), pages[0]);
     hiddenFilesCb = new QCheckBox(i18n("Show &hidden files"), pages[0]);
+    archivesCb = new QCheckBox(i18n("Look inside a&rchives"), pages[0]);
+    ignoreFilesCb = new QCheckBox(i18n("Skip files in .&gitignore"), pages[0]);
+    sameFilesystemCb = new QCheckBox(i18n("Stay on one file s&ystem"), pages[0]);
+    followLinksCb = new QCheckBox(i18n("Follow symbolic lin&ks"), pages[0]);
+    testLinksCb = new QCheckBox(i18n("Test links the&mselves"), pages[0]);
+    hardLinksCb = new QCheckBox(i18n("Report har&d links once"), pages[0]);
+    duplicatesCb = new QCheckBox(i18n("Find duplica&te files"), pages[0]);
+    maxResultsCb = new QCheckBox(i18nc("followed by a number of results", "Stop &after"), pages[0]);
+    maxResultsEdit = new QSpinBox(pages[0]);
+    maxResultsL = new QLabel(pages[0]);
+    depthCb = new QCheckBox(i18nc("followed by two numbers of folder levels", "Only le&vels"), pages[0]);
+    minDepthEdit = new QSpinBox(pages[0]);
+    depthToL = new QLabel(i18nc("as in from level 2 to level 3", "to"), pages[0]);
+    maxDepthEdit = new QSpinBox(pages[0]);
     // Setup
 
     subdirsCb->setChecked(true);
     caseSensCb->setChecked(false);
     useLocateCb->setChecked(false);
     hiddenFilesCb->setChecked(false);
+    archivesCb->setChecked(false);
+    ignoreFilesCb->setChecked(false);
+    sameFilesystemCb->setChecked(false);
+    followLinksCb->setChecked(false);
+    testLinksCb->setChecked(false);
+    hardLinksCb->setChecked(false);
+    duplicatesCb->setChecked(false);
+    maxResultsCb->setChecked(false);
+    maxResultsEdit->setRange(1, 1000000);
+    maxResultsEdit->setValue(100);
+    slotUpdateMaxResultsLabel(maxResultsEdit->value());
+    depthCb->setChecked(false);
+    minDepthEdit->setRange(1, 1000);
+    minDepthEdit->setValue(1);
+    maxDepthEdit->setRange(1, 1000);
+    maxDepthEdit->setValue(2);
     if (KStandardDirs::findExe(QStringLiteral("locate")).isEmpty()) {
         useLocateCb->setEnabled(false);
     }
@@ -143,6 +180,46 @@ KfindTabWidget::KfindTabWidget(QWidget *parent)
                "(using <i>updatedb</i>)."
                "</qt>");
     useLocateCb->setWhatsThis(whatsfileindex);
+    const QString whatsmaxresults
+        = i18n("<qt>Stop the search as soon as this many files were found. "
+               "Use <b>1</b> to only find out whether a matching file exists.</qt>");
+    maxResultsCb->setWhatsThis(whatsmaxresults);
+    maxResultsEdit->setWhatsThis(whatsmaxresults);
+    excludeBox->setWhatsThis(i18n("<qt>The folders matching these names are skipped with everything in them, "
+                                  "for example <b>node_modules;build*</b>. A name with a \"/\" is matched "
+                                  "against the whole path. Hidden folders are skipped as well unless "
+                                  "<i>Show hidden files</i> is checked.</qt>"));
+    ignoreFilesCb->setWhatsThis(i18n("<qt>Skip the files and folders that the <i>.gitignore</i>, <i>.ignore</i> "
+                                     "and <i>.git/info/exclude</i> files of the folders searched ignore, "
+                                     "like build output, and the <i>.git</i> folders themselves.</qt>"));
+    sameFilesystemCb->setWhatsThis(i18n("<qt>Do not search folders that other file systems, like "
+                                        "network shares or removable drives, are mounted on. "
+                                        "Kernel file systems like <i>/proc</i> and <i>/sys</i> are "
+                                        "never searched.</qt>"));
+    followLinksCb->setWhatsThis(i18n("<qt>Also search the folders that symbolic links point to. "
+                                     "A folder reached by several links is searched only once.</qt>"));
+    testLinksCb->setWhatsThis(i18n("<qt>Find links by their own file type instead of the type and "
+                                   "permissions of the file they point to, so that a link to a file "
+                                   "is not found as a file or an executable. Otherwise only broken "
+                                   "links are found as <i>Symbolic Links</i>.</qt>"));
+    hardLinksCb->setWhatsThis(i18n("<qt>List a file reached by several paths, like the hard links of "
+                                   "backup snapshots or the folders of a bind mount, only once, with "
+                                   "the number of its other paths. Its contents are searched once too.</qt>"));
+    duplicatesCb->setWhatsThis(i18n("<qt>Of the files matching the other criteria, only list those "
+                                    "having the same content as another one, grouped, with the space "
+                                    "deleting all but one copy would free. Only files of equal size "
+                                    "are read, and most of them only at their start and end.</qt>"));
+    const QString whatsdepth
+        = i18n("<qt>Only find what is this many levels of subfolders deep. Level 1 is what "
+               "is directly in the folder searched, level 2 what is in its subfolders, and "
+               "so on. Folders deeper than the second number are not read at all, which "
+               "makes shallow searches of large trees fast.</qt>");
+    depthCb->setWhatsThis(whatsdepth);
+    minDepthEdit->setWhatsThis(whatsdepth);
+    maxDepthEdit->setWhatsThis(whatsdepth);
+    archivesCb->setWhatsThis(i18n("<qt>Also search the files in zip and tar archives, "
+                                  "as if the archives were folders. Their contents are only "
+                                  "decompressed to search for text in them.</qt>"));
 
     // Layout
 
@@ -155,19 +232,46 @@ KfindTabWidget::KfindTabWidget(QWidget *parent)
     grid->addWidget(lookinL, 1, 0);
     grid->addWidget(dirBox, 1, 1);
     grid->addWidget(browseB, 1, 2);
+    grid->addWidget(excludeL, 2, 0);
+    grid->addWidget(excludeBox, 2, 1, 1, 2);
     grid->setColumnStretch(1, 1);
-    grid->addLayout(subgrid, 2, 1, 1, 2);
+    grid->addLayout(subgrid, 3, 1, 1, 2);
 
     QHBoxLayout *layoutOne = new QHBoxLayout();
     layoutOne->addWidget(subdirsCb);
     layoutOne->addWidget(hiddenFilesCb);
+    layoutOne->addWidget(archivesCb);
 
     QHBoxLayout *layoutTwo = new QHBoxLayout();
     layoutTwo->addWidget(caseSensCb);
     layoutTwo->addWidget(useLocateCb);
+    layoutTwo->addWidget(ignoreFilesCb);
+
+    QHBoxLayout *layoutThree = new QHBoxLayout();
+    layoutThree->addWidget(maxResultsCb);
+    layoutThree->addWidget(maxResultsEdit);
+    layoutThree->addWidget(maxResultsL);
+    layoutThree->addStretch(1);
+    layoutThree->addWidget(duplicatesCb);
+
+    QHBoxLayout *layoutFour = new QHBoxLayout();
+    layoutFour->addWidget(sameFilesystemCb);
+    layoutFour->addWidget(followLinksCb);
+    layoutFour->addWidget(testLinksCb);
+    layoutFour->addWidget(hardLinksCb);
+
+    QHBoxLayout *layoutFive = new QHBoxLayout();
+    layoutFive->addWidget(depthCb);
+    layoutFive->addWidget(minDepthEdit);
+    layoutFive->addWidget(depthToL);
+    layoutFive->addWidget(maxDepthEdit);
+    layoutFive->addStretch(1);
 
     subgrid->addLayout(layoutOne);
     subgrid->addLayout(layoutTwo);
+    subgrid->addLayout(layoutFour);
+    subgrid->addLayout(layoutFive);
+    subgrid->addLayout(layoutThree);
 
     subgrid->addStretch(1);
 
@@ -179,6 +283,13 @@ KfindTabWidget::KfindTabWidget(QWidget *parent)
 
     connect(dirBox, static_cast<void (KUrlComboBox::*)()>(&KUrlComboBox::returnPressed), this, &KfindTabWidget::startSearch);
 
+    connect(maxResultsCb, &QCheckBox::toggled, this, &KfindTabWidget::fixLayout);
+    connect(subdirsCb, &QCheckBox::toggled, this, &KfindTabWidget::fixLayout);
+    connect(depthCb, &QCheckBox::toggled, this, &KfindTabWidget::fixLayout);
+    // The range never gets empty
+    connect(minDepthEdit, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), maxDepthEdit, &QSpinBox::setMinimum);
+    connect(maxResultsEdit, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), this, &KfindTabWidget::slotUpdateMaxResultsLabel);
+
     // ************ Page Two
 
     pages[1] = new QWidget;
@@ -327,6 +438,23 @@ KfindTabWidget::KfindTabWidget(QWidget *parent)
     caseContextCb = new QCheckBox(i18n("Case s&ensitive"), pages[2]);
     binaryContextCb = new QCheckBox(i18n("Include &binary files"), pages[2]);
     regexpContentCb = new QCheckBox(i18n("Regular e&xpression"), pages[2]);
+    allMatchesCb = new QCheckBox(i18nc("followed by a number of context lines", "Show all mat&ching lines with"), pages[2]);
+    contextLinesEdit = new QSpinBox(pages[2]);
+    contextLinesL = new QLabel(pages[2]);
+
+    allMatchesCb->setChecked(false);
+    contextLinesEdit->setRange(0, 100);
+    contextLinesEdit->setValue(0);
+    slotUpdateContextLinesLabel(contextLinesEdit->value());
+
+    const QString whatsallmatches
+        = i18n("<qt>List every line containing the text below its file instead of "
+               "only the first one, together with this many lines before and after it.</qt>");
+    allMatchesCb->setWhatsThis(whatsallmatches);
+    contextLinesEdit->setWhatsThis(whatsallmatches);
+
+    connect(allMatchesCb, &QCheckBox::toggled, this, &KfindTabWidget::fixLayout);
+    connect(contextLinesEdit, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), this, &KfindTabWidget::slotUpdateContextLinesLabel);
 
     const QString binaryTooltip
         = i18n("<qt>This lets you search in any type of file, "
@@ -334,6 +462,10 @@ KfindTabWidget::KfindTabWidget(QWidget *parent)
                "program files and images).</qt>");
     binaryContextCb->setToolTip(binaryTooltip);
 
+    compressedContextCb = new QCheckBox(i18n("Search in compresse&d files"), pages[2]);
+    compressedContextCb->setToolTip(i18n("<qt>Also search the text of files compressed with "
+                                         "gzip, bzip2, xz or zstd, such as rotated log files.</qt>"));
+
     QPushButton *editRegExp = nullptr;
     if (!KServiceTypeTrader::self()->query(QStringLiteral("KRegExpEditor/KRegExpEditor")).isEmpty()) {
         // The editor is available, so lets use it.
@@ -348,6 +480,33 @@ KfindTabWidget::KfindTabWidget(QWidget *parent)
     QLabel *textMetaKey = new QLabel(i18n("Search &metainfo sections:"), pages[2]);
     textMetaKey->setBuddy(metainfokeyEdit);
 
+    checksumEdit = new KLineEdit(pages[2]);
+    checksumEdit->setClearButtonShown(true);
+    checksumEdit->setObjectName(QStringLiteral("checksumEdit"));
+    checksumEdit->setCompletionObject(new KUrlCompletion(KUrlCompletion::FileCompletion));
+    checksumEdit->setAutoDeleteCompletionObject(true);
+    QLabel *checksumL = new QLabel(i18n("Chec&ksum:"), pages[2]);
+    checksumL->setBuddy(checksumEdit);
+    QPushButton *checksumFileB = new QPushButton(i18n("&Select File..."), pages[2]);
+    checksumXattrCb = new QCheckBox(i18n("Keep checksums &with the files"), pages[2]);
+
+    connect(checksumEdit, &KLineEdit::returnPressed, this, &KfindTabWidget::startSearch);
+    connect(checksumFileB, &QPushButton::clicked, this, &KfindTabWidget::getChecksumFile);
+
+    const QString whatschecksum
+        = i18n("<qt>If specified, only files with this MD5, SHA-1 or SHA-256 "
+               "checksum are found. Enter the checksum in hexadecimal, or a file "
+               "to find the copies of: only the files of its size are then read.<br />"
+               "Checksums are remembered, so files that did not change are not read "
+               "again by the next search.</qt>");
+    checksumEdit->setToolTip(whatschecksum);
+    checksumL->setWhatsThis(whatschecksum);
+    checksumXattrCb->setWhatsThis(i18n("<qt>Store the checksums in extended attributes of the files "
+                                       "themselves, where they survive renames, and use the checksums "
+                                       "found there. Anyone who can write to a file can change its "
+                                       "attributes, and setting them changes the status change time "
+                                       "of the files.</qt>"));
+
     // Setup
     typeBox->addItem(i18n("All Files & Folders"));
     typeBox->addItem(i18n("Files"));
@@ -430,10 +589,25 @@ KfindTabWidget::KfindTabWidget(QWidget *parent)
     grid2->addWidget(caseContextCb, 2, 1);
     grid2->addWidget(binaryContextCb, 3, 1);
 
-    grid2->addWidget(textMetaKey, 4, 0);
-    grid2->addWidget(metainfokeyEdit, 4, 1);
-    grid2->addWidget(textMetaInfo, 4, 2, Qt::AlignHCenter);
-    grid2->addWidget(metainfoEdit, 4, 3);
+    QHBoxLayout *layoutMatches = new QHBoxLayout();
+    layoutMatches->addWidget(allMatchesCb);
+    layoutMatches->addWidget(contextLinesEdit);
+    layoutMatches->addWidget(contextLinesL);
+    layoutMatches->addStretch(1);
+    grid2->addLayout(layoutMatches, 3, 2, 1, 2);
+    grid2->addWidget(compressedContextCb, 4, 1);
+
+    grid2->addWidget(textMetaKey, 5, 0);
+    grid2->addWidget(metainfokeyEdit, 5, 1);
+    grid2->addWidget(textMetaInfo, 5, 2, Qt::AlignHCenter);
+    grid2->addWidget(metainfoEdit, 5, 3);
+
+    QHBoxLayout *layoutChecksum = new QHBoxLayout();
+    layoutChecksum->addWidget(checksumEdit, 1);
+    layoutChecksum->addWidget(checksumFileB);
+    grid2->addWidget(checksumL, 6, 0);
+    grid2->addLayout(layoutChecksum, 6, 1, 1, 3);
+    grid2->addWidget(checksumXattrCb, 7, 1, 1, 3);
 
     metainfokeyEdit->setText(QStringLiteral("*"));
 
@@ -523,6 +697,7 @@ void KfindTabWidget::saveHistory()
 {
     save_pattern(nameBox, QStringLiteral("History"), QStringLiteral("Patterns"));
     save_pattern(dirBox, QStringLiteral("History"), QStringLiteral("Directories"));
+    save_pattern(excludeBox, QStringLiteral("History"), QStringLiteral("ExcludedFolders"));
 }
 
 void KfindTabWidget::loadHistory()
@@ -536,6 +711,13 @@ void KfindTabWidget::loadHistory()
         nameBox->addItem(QStringLiteral("*"));
     }
 
+    sl = conf.readPathEntry(QStringLiteral("ExcludedFolders"), QStringList());
+    if (!sl.isEmpty()) {
+        excludeBox->addItems(sl);
+    } else {
+        excludeBox->addItem(QString());
+    }
+
     sl = conf.readPathEntry(QStringLiteral("Directories"), QStringList());
     if (!sl.isEmpty()) {
         dirBox->addItems(sl);
@@ -639,6 +821,35 @@ bool KfindTabWidget::isDateValid()
     return true;
 }
 
+/*
+  Reads the checksum searched, typed in or of a reference file, and
+  popups a error box if there is neither.
+*/
+bool KfindTabWidget::readChecksum(QByteArray *checksum, QCryptographicHash::Algorithm *algorithm, qint64 *size)
+{
+    *size = -1;
+    const QString text = checksumEdit->text().trimmed();
+    if (text.isEmpty() || KQuery::parseChecksum(text, checksum, algorithm)) {
+        return true;
+    }
+
+    const QFileInfo reference(KShell::tildeExpand(text));
+    if (reference.isFile()) {
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        *algorithm = QCryptographicHash::Sha256;
+        const bool ok = KQueryContentScanner::checksum(reference.absoluteFilePath(), *algorithm, checksum);
+        QApplication::restoreOverrideCursor();
+        if (ok) {
+            *size = reference.size();
+            return true;
+        }
+    }
+
+    KMessageBox::sorry(this, i18n("The checksum must be an MD5, SHA-1 or SHA-256 checksum in hexadecimal, "
+                                  "or a file that can be read."));
+    return false;
+}
+
 void KfindTabWidget::setQuery(KQuery *query)
 {
     KIO::filesize_t size;
@@ -649,6 +860,13 @@ void KfindTabWidget::setQuery(KQuery *query)
         return;
     }
 
+    QByteArray checksum;
+    QCryptographicHash::Algorithm checksumAlgorithm = QCryptographicHash::Sha256;
+    qint64 checksumSize;
+    if (!readChecksum(&checksum, &checksumAlgorithm, &checksumSize)) {
+        return;
+    }
+
     const QString trimmedDirBoxText = dirBox->currentText().trimmed();
     const QString tildeExpandedPath = KShell::tildeExpand(trimmedDirBoxText);
 
@@ -678,6 +896,11 @@ void KfindTabWidget::setQuery(KQuery *query)
     }
 
     query->setRecursive(subdirsCb->isChecked());
+    if (subdirsCb->isChecked() && depthCb->isChecked()) {
+        query->setDepthRange(minDepthEdit->value(), maxDepthEdit->value());
+    } else {
+        query->setDepthRange(1, -1);
+    }
 
     switch (sizeUnitBox->currentIndex()) {
     case 0:
@@ -786,13 +1009,32 @@ void KfindTabWidget::setQuery(KQuery *query)
     //Metainfo
     query->setMetaInfo(metainfoEdit->text(), metainfokeyEdit->text());
 
+    query->setChecksum(checksum, checksumAlgorithm, checksumSize);
+    query->setChecksumXattr(checksumXattrCb->isChecked());
+
     //Use locate to speed-up search ?
     query->setUseFileIndex(useLocateCb->isChecked());
 
     query->setShowHiddenFiles(hiddenFilesCb->isChecked());
+    query->setUseIgnoreFiles(ignoreFilesCb->isChecked());
+    query->setExcludedFolders(excludeBox->currentText().split(QLatin1Char(';'), QString::SkipEmptyParts));
+    query->setSearchArchives(archivesCb->isChecked());
+    query->setStayOnFilesystem(sameFilesystemCb->isChecked());
+    query->setFollowSymlinks(followLinksCb->isChecked());
+    query->setTestLinkTargets(!testLinksCb->isChecked());
+    query->setCollapseHardLinks(hardLinksCb->isChecked());
+    query->setFindDuplicates(duplicatesCb->isChecked());
+    // Not in the dialog, a hanging share is the rare case these are for
+    const KConfigGroup searchConf(KSharedConfig::openConfig(), QStringLiteral("Search"));
+    query->setNetworkMountLimits(searchConf.readEntry(QStringLiteral("MaxJobsPerNetworkMount"), 1),
+                                 searchConf.readEntry(QStringLiteral("NetworkMountTimeout"), 30));
+
+    query->setMaxResults(maxResultsCb->isChecked() ? maxResultsEdit->value() : 0);
 
     query->setContext(textEdit->text(), caseContextCb->isChecked(),
                       binaryContextCb->isChecked(), regexpContentCb->isChecked());
+    query->setAllMatches(allMatchesCb->isChecked(), contextLinesEdit->value());
+    query->setSearchCompressed(compressedContextCb->isChecked());
 }
 
 void KfindTabWidget::getDirectory()
@@ -812,6 +1054,15 @@ void KfindTabWidget::getDirectory()
     }
 }
 
+void KfindTabWidget::getChecksumFile()
+{
+    const QString result = QFileDialog::getOpenFileName(this, i18n("Select the File to Find Copies Of"),
+                                                        dirBox->currentText().trimmed());
+    if (!result.isEmpty()) {
+        checksumEdit->setText(result);
+    }
+}
+
 void KfindTabWidget::beginSearch()
 {
 ///  dirlister->openUrl(KUrl(dirBox->currentText().trimmed()));
@@ -864,6 +1115,21 @@ void KfindTabWidget::fixLayout()
     // Size box on page three
     sizeEdit->setEnabled(sizeBox->currentIndex() != 0);
     sizeUnitBox->setEnabled(sizeBox->currentIndex() != 0);
+
+    // Result limit on page one
+    maxResultsEdit->setEnabled(maxResultsCb->isChecked());
+    maxResultsL->setEnabled(maxResultsCb->isChecked());
+
+    // Levels only matter when subfolders are searched
+    depthCb->setEnabled(subdirsCb->isChecked());
+    const bool limitsDepth = subdirsCb->isChecked() && depthCb->isChecked();
+    minDepthEdit->setEnabled(limitsDepth);
+    depthToL->setEnabled(limitsDepth);
+    maxDepthEdit->setEnabled(limitsDepth);
+
+    // Context lines on the contents page
+    contextLinesEdit->setEnabled(allMatchesCb->isChecked());
+    contextLinesL->setEnabled(allMatchesCb->isChecked());
 }
 
 bool KfindTabWidget::isSearchRecursive()
@@ -899,6 +1165,16 @@ void KfindTabWidget::slotUpdateByteComboBox(int value)
     sizeUnitBox->setItemText(0, i18np("Byte", "Bytes", value));
 }
 
+void KfindTabWidget::slotUpdateMaxResultsLabel(int value)
+{
+    maxResultsL->setText(i18ncp("preceded by 'Stop after' and a number", "result", "results", value));
+}
+
+void KfindTabWidget::slotUpdateContextLinesLabel(int value)
+{
+    contextLinesL->setText(i18ncp("preceded by 'Show all matching lines with' and a number", "line of context", "lines of context", value));
+}
+
 /**
    Digit validator. Allows only digits to be typed.
 **/
@@ -19,6 +19,7 @@
 #ifndef KFTABDLG_H
 #define KFTABDLG_H
 
+#include <QCryptographicHash>
 #include <QMimeType>
 #include <QValidator> // for KDigitValidator
 
@@ -70,9 +71,12 @@ public Q_SLOTS:
 
 private Q_SLOTS:
     void getDirectory();
+    void getChecksumFile();
     void fixLayout();
     void slotSizeBoxChanged(int);
     void slotEditRegExp();
+    void slotUpdateMaxResultsLabel(int value);
+    void slotUpdateContextLinesLabel(int value);
 
 Q_SIGNALS:
     void startSearch();
@@ -81,10 +85,18 @@ protected:
 public:
     KComboBox *nameBox;
     KUrlComboBox *dirBox;
+    KComboBox *excludeBox;
     // for first page
     QCheckBox *subdirsCb;
     QCheckBox *useLocateCb;
     QCheckBox *hiddenFilesCb;
+    QCheckBox *archivesCb;
+    QCheckBox *ignoreFilesCb;
+    QCheckBox *sameFilesystemCb;
+    QCheckBox *followLinksCb;
+    QCheckBox *testLinksCb;
+    QCheckBox *hardLinksCb;
+    QCheckBox *duplicatesCb;
     // for third page
     KComboBox *typeBox;
     KLineEdit *textEdit;
@@ -94,9 +106,12 @@ public:
     //for fourth page
     KLineEdit *metainfoEdit;
     KLineEdit *metainfokeyEdit;
+    KLineEdit *checksumEdit;
+    QCheckBox *checksumXattrCb;
 
 private:
     bool isDateValid();
+    bool readChecksum(QByteArray *checksum, QCryptographicHash::Algorithm *algorithm, qint64 *size);
     void fillDirBox();
 
     void updateDateLabels(int type, int value);
@@ -105,6 +120,13 @@ private:
 
     //1st page
     QPushButton *browseB;
+    QCheckBox *maxResultsCb;
+    QSpinBox *maxResultsEdit;
+    QLabel *maxResultsL;
+    QCheckBox *depthCb;
+    QSpinBox *minDepthEdit;
+    QLabel *depthToL;
+    QSpinBox *maxDepthEdit;
 
     KfDirDialog *dirselector;
 
@@ -124,7 +146,11 @@ private:
     QSpinBox *sizeEdit;
     QCheckBox *caseContextCb;
     QCheckBox *binaryContextCb;
+    QCheckBox *compressedContextCb;
     QCheckBox *regexpContentCb;
+    QCheckBox *allMatchesCb;
+    QSpinBox *contextLinesEdit;
+    QLabel *contextLinesL;
     QDialog *regExpDialog;
 
     QUrl m_url;
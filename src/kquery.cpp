@@ -18,20 +18,22 @@
 
 #include "kquery.h"
 #include "kfind_debug.h"
+#include "kfindtrace.h"
+#include "kqueryarchive.h"
+#include "kqueryduplicates.h"
+#include "kquerywalker.h"
+#include <ctype.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
-#include <QCoreApplication>
+#include <QApplication>
+#include <QTimer>
 #include <QFileInfo>
-#include <QTextCodec>
-#include <QTextStream>
 #include <QList>
-#include <kmimetype.h>
 #include <kfileitem.h>
-#include <kfilemetainfo.h>
 #include <KLocalizedString>
 #include <kmessagebox.h>
 #include <kstandarddirs.h>
-#include <kzip.h>
 
 KQuery::KQuery(QObject *parent)
     : QObject(parent)
@@ -42,47 +44,50 @@ KQuery::KQuery(QObject *parent)
     , m_timeFrom(0)
     , m_timeTo(0)
     , m_recursive(false)
-    , m_casesensitive(false)
-    , m_search_binary(false)
-    , m_regexpForContent(false)
+    , m_minDepth(1)
+    , m_maxDepth(-1)
+    , m_checksumSize(-1)
     , m_useLocate(false)
     , m_showHiddenFiles(false)
-    , job(0)
+    , m_useIgnoreFiles(false)
+    , m_followSymlinks(false)
+    , m_testLinkTargets(true)
+    , m_collapseHardLinks(false)
+    , m_otherLinksFound(false)
+    , m_maxResults(0)
+    , m_resultCount(0)
+    , m_walker(new KQueryWalker(this))
+    , m_scanner(new KQueryContentScanner(this))
+    , m_archives(new KQueryArchiveLister(this))
+    , m_duplicates(new KQueryDuplicateFinder(this))
+    , m_findDuplicates(false)
+    , m_searchArchives(false)
     , m_insideCheckEntries(false)
+    , m_running(false)
+    , m_listing(false)
     , m_result(0)
+    , m_traceStart(-1)
 {
     processLocate = new KProcess(this);
     connect(processLocate, SIGNAL(readyReadStandardOutput()), this, SLOT(slotreadyReadStandardOutput()));
     connect(processLocate, SIGNAL(readyReadStandardError()), this, SLOT(slotreadyReadStandardError()));
     connect(processLocate, SIGNAL(finished(int,QProcess::ExitStatus)), this, SLOT(slotendProcessLocate(int,QProcess::ExitStatus)));
 
-    // Files with these mime types can be ignored, even if
-    // findFormatByFileContent() in some cases may claim that
-    // these are text files:
-    ignore_mimetypes.append(QStringLiteral("application/pdf"));
-    ignore_mimetypes.append(QStringLiteral("application/postscript"));
-
-    // PLEASE update the documentation when you add another
-    // file type here:
-    ooo_mimetypes.append(QStringLiteral("application/vnd.sun.xml.writer"));
-    ooo_mimetypes.append(QStringLiteral("application/vnd.sun.xml.calc"));
-    ooo_mimetypes.append(QStringLiteral("application/vnd.sun.xml.impress"));
-    // OASIS mimetypes, used by OOo-2.x and KOffice >= 1.4
-    //ooo_mimetypes.append("application/vnd.oasis.opendocument.chart");
-    //ooo_mimetypes.append("application/vnd.oasis.opendocument.graphics");
-    //ooo_mimetypes.append("application/vnd.oasis.opendocument.graphics-template");
-    //ooo_mimetypes.append("application/vnd.oasis.opendocument.formula");
-    //ooo_mimetypes.append("application/vnd.oasis.opendocument.image");
-    ooo_mimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.presentation-template"));
-    ooo_mimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.presentation"));
-    ooo_mimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.spreadsheet-template"));
-    ooo_mimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.spreadsheet"));
-    ooo_mimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.text-template"));
-    ooo_mimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.text"));
-    // KOffice-1.3 mimetypes
-    koffice_mimetypes.append(QStringLiteral("application/x-kword"));
-    koffice_mimetypes.append(QStringLiteral("application/x-kspread"));
-    koffice_mimetypes.append(QStringLiteral("application/x-kpresenter"));
+    connect(m_walker, SIGNAL(entries(QUrl,KIO::UDSEntryList)), SLOT(slotListEntries(QUrl,KIO::UDSEntryList)));
+    connect(m_walker, SIGNAL(finished(int)), SLOT(slotResult(int)));
+
+    // Sampling the counters on a timer keeps the per-file path free of any reporting
+    m_progressTimer = new QTimer(this);
+    m_progressTimer->setInterval(500);
+    connect(m_progressTimer, SIGNAL(timeout()), SLOT(slotProgress()));
+
+    connect(m_scanner, &KQueryContentScanner::found, this, &KQuery::slotScanned);
+    connect(m_scanner, &KQueryContentScanner::idle, this, &KQuery::finishIfDone);
+
+    connect(m_archives, SIGNAL(entries(QUrl,KIO::UDSEntryList)), SLOT(slotListEntries(QUrl,KIO::UDSEntryList)));
+    connect(m_archives, &KQueryArchiveLister::idle, this, &KQuery::finishIfDone);
+
+    connect(m_duplicates, &KQueryDuplicateFinder::idle, this, &KQuery::finishIfDone);
 }
 
 KQuery::~KQuery()
@@ -101,18 +106,46 @@ KQuery::~KQuery()
 
 void KQuery::kill()
 {
-    if (job) {
-        job->kill(KJob::EmitResult);
+    // Nothing waits for running scans, they stop on their own
+    m_fileItems.clear();
+    m_scanner->cancel();
+    m_archives->cancel();
+    m_duplicates->cancel();
+    if (m_running) {
+        m_result = KIO::ERR_USER_CANCELED;
     }
+    m_walker->kill();
     if (processLocate->state() == QProcess::Running) {
         processLocate->kill();
     }
-    m_fileItems.clear();
+    finishIfDone();
 }
 
 void KQuery::start()
 {
+    KFindTrace::Scope trace("KQuery::start");
     m_fileItems.clear();
+    m_scanner->cancel();
+    m_scanner->setCriteria(m_content);
+    m_archives->cancel();
+    m_archives->setRecursive(m_recursive);
+    m_duplicates->cancel();
+    m_inodes.clear();
+    m_scannedLinks.clear();
+    m_otherLinksFound = false;
+    m_running = true;
+    m_listing = true;
+    m_result = 0;
+    m_resultCount = 0;
+    KQueryStats::beginSearch();
+    m_statsBaseline = KQueryStats::snapshot();
+    m_traceStart = KFindTrace::isEnabled() ? KFindTrace::now() : -1;
+    m_progressSnapshot = m_statsBaseline;
+    m_progressTimer->start();
+    m_pruneRules.skipHidden = !m_showHiddenFiles;
+    m_archives->setDepthRange(m_minDepth, m_maxDepth);
+    m_archives->setPruneRules(m_pruneRules);
+    m_archives->setUseIgnoreFiles(m_useIgnoreFiles);
     if (m_useLocate) { //Use "locate" instead of the internal search method
         bufferLocate.clear();
         m_url = m_url.adjusted(QUrl::NormalizePathSegments);
@@ -123,49 +156,69 @@ void KQuery::start()
         processLocate->setOutputChannelMode(KProcess::SeparateChannels);
         processLocate->start();
     } else { //Use KIO
-        if (m_recursive) {
-            job = KIO::listRecursive(m_url, KIO::HideProgressInfo);
-        } else {
-            job = KIO::listDir(m_url, KIO::HideProgressInfo);
-        }
-
-        connect(job, SIGNAL(entries(KIO::Job *,KIO::UDSEntryList)),
-                SLOT(slotListEntries(KIO::Job *,KIO::UDSEntryList)));
-        connect(job, SIGNAL(result(KJob *)), SLOT(slotResult(KJob *)));
-        connect(job, SIGNAL(canceled(KJob *)), SLOT(slotCanceled(KJob *)));
+        m_walker->setRecursive(m_recursive);
+        m_walker->setDepthRange(m_minDepth, m_maxDepth);
+        m_walker->setPruneRules(m_pruneRules);
+        m_walker->setUseIgnoreFiles(m_useIgnoreFiles);
+        m_walker->setFollowSymlinks(m_followSymlinks);
+        m_walker->setListInodes(m_collapseHardLinks || m_findDuplicates);
+        m_walker->start(m_url);
     }
 }
 
-void KQuery::slotResult(KJob *_job)
+void KQuery::slotResult(int error)
 {
-    if (job != _job) {
-        return;
-    }
-    job = nullptr;
-
-    m_result = _job->error();
+    m_result = error;
+    m_listing = false;
     checkEntries();
 }
 
-void KQuery::slotCanceled(KJob *_job)
+void KQuery::slotScanned(const QList<KQueryResult> &scanned)
 {
-    if (job != _job) {
+    if (m_findDuplicates) {
+        for (const KQueryResult &result : scanned) {
+            addDuplicateCandidate(result.item);
+        }
         return;
     }
-    job = nullptr;
 
-    m_fileItems.clear();
+    QList<KQueryResult> list = scanned;
+    if (!m_scannedLinks.isEmpty()) {
+        for (KQueryResult &result : list) {
+            result.otherLinks = m_scannedLinks.take(result.item.url());
+        }
+    }
 
-    m_result = KIO::ERR_USER_CANCELED;
-    checkEntries();
+    if (m_maxResults > 0 && m_resultCount + list.size() >= m_maxResults) {
+        const QList<KQueryResult> wanted = list.mid(0, m_maxResults - m_resultCount);
+        KQueryStats::add(KQueryStats::FilesFound, wanted.size());
+        m_resultCount += wanted.size();
+        if (!wanted.isEmpty()) {
+            KFindTrace::Scope trace("foundFileList", wanted.size());
+            emit foundFileList(wanted);
+        }
+        stopAtLimit();
+        return;
+    }
+
+    KQueryStats::add(KQueryStats::FilesFound, list.size());
+    m_resultCount += list.size();
+    KFindTrace::Scope trace("foundFileList", list.size());
+    emit foundFileList(list);
 }
 
-void KQuery::slotListEntries(KIO::Job *, const KIO::UDSEntryList &list)
+void KQuery::slotListEntries(const QUrl &dir, const KIO::UDSEntryList &list)
 {
-    const KIO::UDSEntryList::ConstIterator end = list.constEnd();
+    {
+        KFindTrace::Scope trace("listEntries", list.size());
+        KQueryStats::StageTimer timer(KQueryStats::EntriesStage);
+        KQueryStats::add(KQueryStats::EntriesSeen, list.size());
+
+        const KIO::UDSEntryList::ConstIterator end = list.constEnd();
 
-    for (KIO::UDSEntryList::ConstIterator it = list.constBegin(); it != end; ++it) {
-        m_fileItems.enqueue(KFileItem(*it, m_url, true, true));
+        for (KIO::UDSEntryList::ConstIterator it = list.constBegin(); it != end; ++it) {
+            m_fileItems.enqueue(KFileItem(*it, dir, true, true));
+        }
     }
 
     checkEntries();
@@ -179,9 +232,6 @@ void KQuery::checkEntries()
 
     m_insideCheckEntries = true;
 
-    metaKeyRx = QRegExp(m_metainfokey);
-    metaKeyRx.setPatternSyntax(QRegExp::Wildcard);
-
     m_foundFilesList.clear();
 
     int processingCount = 0;
@@ -190,13 +240,12 @@ void KQuery::checkEntries()
         processQuery(m_fileItems.dequeue());
         processingCount++;
 
-        /* This is a workaround. As the qApp->processEvents() call inside processQuery
-         * will bring more KIO entries, m_fileItems will increase even inside this loop
-         * and that will lead to a big loop, it will take time to report found items to the GUI
-         * so we are going to force emit results every 100 files processed */
+        /* Report found items every 100 files processed, so the GUI does not
+         * wait for a whole listing batch of a large folder */
         if (processingCount == 100) {
             processingCount = 0;
             if (m_foundFilesList.size() > 0) {
+                KFindTrace::Scope trace("foundFileList", m_foundFilesList.size());
                 emit foundFileList(m_foundFilesList);
                 m_foundFilesList.clear();
             }
@@ -204,33 +253,136 @@ void KQuery::checkEntries()
     }
 
     if (m_foundFilesList.size() > 0) {
+        KFindTrace::Scope trace("foundFileList", m_foundFilesList.size());
         emit foundFileList(m_foundFilesList);
     }
-
-    if (job == 0) {
-        emit result(m_result);
+    if (m_otherLinksFound) {
+        m_otherLinksFound = false;
+        emit otherLinksFound();
     }
 
     m_insideCheckEntries = false;
+    finishIfDone();
+}
+
+void KQuery::stopAtLimit()
+{
+    m_fileItems.clear();
+    m_scanner->cancel();
+    m_archives->cancel();
+    // The walker reports success, m_result stays 0
+    m_walker->stop();
+    // Its end finishes the search, with the rest of its output dropped
+    if (processLocate->state() == QProcess::Running) {
+        bufferLocate.clear();
+        processLocate->kill();
+    }
+    finishIfDone();
+}
+
+void KQuery::finishIfDone()
+{
+    if (!m_running || m_listing || m_insideCheckEntries || m_scanner->pendingCount() > 0
+        || m_archives->pendingCount() > 0 || m_duplicates->pendingCount() > 0) {
+        return;
+    }
+
+    if (m_findDuplicates && m_result == 0) {
+        reportDuplicates();
+    }
+
+    m_running = false;
+    m_progressTimer->stop();
+    // Every member has been searched, the decompressed archives can go
+    m_archives->closeArchives();
+    reportStatistics();
+    emit result(m_result);
 }
 
 /* List of files found using slocate */
 void KQuery::slotListEntries(QStringList list)
 {
-    metaKeyRx = QRegExp(m_metainfokey);
-    metaKeyRx.setPatternSyntax(QRegExp::Wildcard);
-
     QStringList::const_iterator it = list.constBegin();
     QStringList::const_iterator end = list.constEnd();
 
     m_foundFilesList.clear();
     for (; it != end; ++it) {
-        processQuery(KFileItem(KFileItem::Unknown, KFileItem::Unknown, QUrl::fromLocalFile(*it)));
+        if (m_maxResults > 0 && m_resultCount >= m_maxResults) {
+            break;
+        }
+        KQueryStats::add(KQueryStats::EntriesSeen);
+        if (isOutsideDepthRange(*it) || isInPrunedFolder(*it)) {
+            continue;
+        }
+        KQueryStats::add(KQueryStats::StatsIssued);
+        KFileItem item;
+        {
+            // The item stats the file itself as its mode is unknown
+            KQueryStats::StageTimer timer(KQueryStats::StatStage);
+            item = KFileItem(KFileItem::Unknown, KFileItem::Unknown, QUrl::fromLocalFile(*it));
+        }
+        processQuery(item);
     }
 
     if (!m_foundFilesList.isEmpty()) {
+        KFindTrace::Scope trace("foundFileList", m_foundFilesList.size());
         emit foundFileList(m_foundFilesList);
     }
+    if (m_otherLinksFound) {
+        m_otherLinksFound = false;
+        emit otherLinksFound();
+    }
+}
+
+bool KQuery::isInPrunedFolder(const QString &path) const
+{
+    if (m_pruneRules.isEmpty()) {
+        return false;
+    }
+
+    // locate knows nothing of the rules, its paths are checked folder by folder
+    QString root = m_url.toLocalFile();
+    if (!root.endsWith(QLatin1Char('/'))) {
+        root += QLatin1Char('/');
+    }
+    if (!path.startsWith(root)) {
+        return false;
+    }
+
+    for (int slash = path.indexOf(QLatin1Char('/'), root.length()); slash != -1;
+         slash = path.indexOf(QLatin1Char('/'), slash + 1)) {
+        const QString folder = path.left(slash);
+        if (m_pruneRules.isPruned(folder.mid(folder.lastIndexOf(QLatin1Char('/')) + 1), folder)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int KQuery::depthBelowRoot(const QString &path) const
+{
+    QString root = m_url.toLocalFile();
+    if (!root.endsWith(QLatin1Char('/'))) {
+        root += QLatin1Char('/');
+    }
+    if (!path.startsWith(root)) {
+        return 0;
+    }
+    return path.midRef(root.length()).count(QLatin1Char('/')) + 1;
+}
+
+bool KQuery::isOutsideDepthRange(const QString &path) const
+{
+    if (m_minDepth <= 1 && m_maxDepth < 0) {
+        return false;
+    }
+
+    // locate lists the whole tree, its paths are measured instead
+    const int depth = depthBelowRoot(path);
+    if (depth == 0) {
+        return false;
+    }
+    return depth < m_minDepth || (m_maxDepth >= 0 && depth > m_maxDepth);
 }
 
 /* Check if file meets the find's requirements*/
@@ -241,9 +393,16 @@ void KQuery::processQuery(const KFileItem &file)
     }
 
     if (!m_showHiddenFiles && file.isHidden()) {
+        KQueryStats::add(KQueryStats::RejectedHidden);
         return;
     }
 
+    // The members are checked once listed, the archive itself right away
+    if (m_searchArchives && file.isLocalFile() && file.isRegularFile()
+        && KQueryArchiveLister::isArchive(file.name())) {
+        m_archives->list(file.localPath(), depthBelowRoot(file.localPath()));
+    }
+
     bool matched = false;
 
     QListIterator<QRegExp *> nextItem(m_regexps);
@@ -253,264 +412,335 @@ void KQuery::processQuery(const KFileItem &file)
         matched = matched || (reg == nullptr) || (reg->exactMatch(file.url().adjusted(QUrl::StripTrailingSlash).fileName()));
     }
     if (!matched) {
+        KQueryStats::add(KQueryStats::RejectedName);
         return;
     }
 
     // make sure the files are in the correct range
+    bool sizeMatched = true;
     switch (m_sizemode) {
     case 1: // "at least"
-        if (file.size() < m_sizeboundary1) {
-            return;
-        }
+        sizeMatched = file.size() >= m_sizeboundary1;
         break;
     case 2: // "at most"
-        if (file.size() > m_sizeboundary1) {
-            return;
-        }
+        sizeMatched = file.size() <= m_sizeboundary1;
         break;
     case 3: // "equal"
-        if (file.size() != m_sizeboundary1) {
-            return;
-        }
+        sizeMatched = file.size() == m_sizeboundary1;
         break;
     case 4: // "between"
-        if ((file.size() < m_sizeboundary1)
-            || (file.size() > m_sizeboundary2)) {
-            return;
-        }
+        sizeMatched = (file.size() >= m_sizeboundary1)
+                      && (file.size() <= m_sizeboundary2);
         break;
     case 0: // "none" -> Fall to default
     default:
         break;
     }
+    // Only files as large as the one the checksum was taken of can have it
+    if (m_checksumSize >= 0 && file.size() != KIO::filesize_t(m_checksumSize)) {
+        sizeMatched = false;
+    }
+    if (!sizeMatched) {
+        KQueryStats::add(KQueryStats::RejectedSize);
+        return;
+    }
 
     // make sure it's in the correct date range
     // what about 0 times?
-    if (m_timeFrom && ((uint)m_timeFrom) > file.time(KFileItem::ModificationTime).toTime_t()) {
-        return;
-    }
-    if (m_timeTo && ((uint)m_timeTo) < file.time(KFileItem::ModificationTime).toTime_t()) {
+    if ((m_timeFrom && ((uint)m_timeFrom) > file.time(KFileItem::ModificationTime).toTime_t())
+        || (m_timeTo && ((uint)m_timeTo) < file.time(KFileItem::ModificationTime).toTime_t())) {
+        KQueryStats::add(KQueryStats::RejectedTime);
         return;
     }
 
     // username / group match
-    if ((!m_username.isEmpty()) && (m_username != file.user())) {
-        return;
-    }
-    if ((!m_groupname.isEmpty()) && (m_groupname != file.group())) {
+    if (((!m_username.isEmpty()) && (m_username != file.user()))
+        || ((!m_groupname.isEmpty()) && (m_groupname != file.group()))) {
+        KQueryStats::add(KQueryStats::RejectedOwner);
         return;
     }
 
-    // file type
+    // file type, mode() and permissions() are those of the link target
+    // already
+    bool typeMatched = true;
+    const bool testsLink = file.isLink() && !m_testLinkTargets;
     switch (m_filetype) {
     case 0:
         break;
     case 1: // plain file
-        if (!S_ISREG(file.mode())) {
-            return;
-        }
+        typeMatched = S_ISREG(file.mode()) && !testsLink;
         break;
     case 2:
-        if (!file.isDir()) {
-            return;
-        }
+        typeMatched = file.isDir() && !testsLink;
         break;
     case 3:
-        if (!file.isLink()) {
-            return;
-        }
+        // Testing targets only links pointing nowhere are left, like find -L
+        typeMatched = m_testLinkTargets ? S_ISLNK(file.mode()) : file.isLink();
         break;
     case 4:
-        if (!S_ISCHR(file.mode()) && !S_ISBLK(file.mode())
-            && !S_ISFIFO(file.mode()) && !S_ISSOCK(file.mode())) {
-            return;
-        }
+        typeMatched = (S_ISCHR(file.mode()) || S_ISBLK(file.mode())
+                       || S_ISFIFO(file.mode()) || S_ISSOCK(file.mode())) && !testsLink;
         break;
     case 5: // binary
-        if ((file.permissions() & 0111) != 0111 || file.isDir()) {
-            return;
-        }
+        typeMatched = (file.permissions() & 0111) == 0111 && !file.isDir() && !testsLink;
         break;
     case 6: // suid
-        if ((file.permissions() & 04000) != 04000) { // fixme
-            return;
-        }
+        typeMatched = (file.permissions() & 04000) == 04000 && !testsLink;
         break;
     default:
-        if (!m_mimetype.isEmpty() && !m_mimetype.contains(file.mimetype())) {
-            return;
+        if (!m_mimetype.isEmpty()) {
+            KQueryStats::StageTimer timer(KQueryStats::MimeTypeStage);
+            typeMatched = m_mimetype.contains(file.mimetype());
         }
     }
+    if (!typeMatched) {
+        KQueryStats::add(KQueryStats::RejectedType);
+        return;
+    }
 
-    // match data in metainfo...
-    if ((!m_metainfo.isEmpty()) && (!m_metainfokey.isEmpty())) {
-        //Avoid sequential files (fifo,char devices)
-        if (!file.isRegularFile()) {
-            return;
-        }
+    // Only the contents of files on disk can be compared, and hard
+    // links of a file are no copies to delete
+    if (m_findDuplicates && (!file.isLocalFile() || !file.isRegularFile() || file.size() == 0)) {
+        KQueryStats::add(KQueryStats::RejectedType);
+        return;
+    }
+
+    if (!m_content.checksum.isEmpty() && (!file.isLocalFile() || !file.isRegularFile())) {
+        KQueryStats::add(KQueryStats::RejectedType);
+        return;
+    }
 
-        bool foundmeta = false;
-        QString filename = file.url().path();
+    // Later paths to a file share the verdict on the first one. The
+    // duplicate search drops hard links by itself, among files of one size.
+    QSharedPointer<int> otherLinks;
+    if (m_collapseHardLinks && isOtherLink(file, &otherLinks)) {
+        return;
+    }
 
-        if (filename.startsWith(QLatin1String("/dev/"))) {
-            return;
+    // metainfo and content are checked on other threads
+    if (!m_content.isEmpty()) {
+        if (otherLinks) {
+            m_scannedLinks.insert(file.url(), otherLinks);
         }
+        m_scanner->scan(file);
+        return;
+    }
+
+    if (m_findDuplicates) {
+        addDuplicateCandidate(file);
+        return;
+    }
 
-        KFileMetaInfo metadatas(filename);
-        QStringList metakeys;
-        QString strmetakeycontent;
+    KQueryStats::add(KQueryStats::FilesFound);
+    KQueryResult result(file);
+    result.otherLinks = otherLinks;
+    m_foundFilesList.append(result);
+    if (++m_resultCount == m_maxResults) {
+        stopAtLimit();
+    }
+}
 
-        metakeys = metadatas.supportedKeys();
-        for (QStringList::const_iterator it = metakeys.constBegin(); it != metakeys.constEnd(); ++it) {
-            if (!metaKeyRx.exactMatch(*it)) {
-                continue;
-            }
-            strmetakeycontent = metadatas.item(*it).value().toString();
-            if (strmetakeycontent.indexOf(m_metainfo) != -1) {
-                foundmeta = true;
-                break;
-            }
+bool KQuery::isOtherLink(const KFileItem &file, QSharedPointer<int> *otherLinks)
+{
+    const KIO::UDSEntry entry = file.entry();
+    quint64 device = entry.numberValue(KIO::UDSEntry::UDS_DEVICE_ID, 0);
+    quint64 inode = entry.numberValue(KIO::UDSEntry::UDS_INODE, 0);
+    if (inode == 0) {
+        // From locate, or a KIO slave not telling
+        if (!file.isLocalFile()) {
+            return false;
         }
-        if (!foundmeta) {
-            return;
+        struct stat buf;
+        KQueryStats::add(KQueryStats::StatsIssued);
+        if (::stat(QFile::encodeName(file.localPath()).constData(), &buf) != 0) {
+            return false;
         }
+        device = buf.st_dev;
+        inode = buf.st_ino;
     }
 
-    // match contents...
-    QString matchingLine;
-    if (!m_context.isEmpty()) {
-        //Avoid sequential files (fifo,char devices)
-        if (!file.isRegularFile()) {
-            return;
-        }
+    const QPair<quint64, quint64> id(device, inode);
+    QHash<QPair<quint64, quint64>, QSharedPointer<int> >::iterator it = m_inodes.find(id);
+    if (it == m_inodes.end()) {
+        *otherLinks = QSharedPointer<int>(new int(0));
+        m_inodes.insert(id, *otherLinks);
+        return false;
+    }
 
-        if (!m_search_binary && ignore_mimetypes.indexOf(file.mimetype()) != -1) {
-            return;
-        }
+    KQueryStats::add(KQueryStats::LinksCollapsed);
+    ++**it;
+    m_otherLinksFound = true;
+    return true;
+}
 
-        bool found = false;
-        bool isZippedOfficeDocument = false;
-        int matchingLineNumber = 0;
-
-        // FIXME: doesn't work with non local files
-
-        QString filename;
-        QTextStream *stream = 0;
-        QFile qf;
-        QRegExp xmlTags;
-        QByteArray zippedXmlFileContent;
-
-        // KWord's and OpenOffice.org's files are zipped...
-        if (ooo_mimetypes.indexOf(file.mimetype()) != -1
-            || koffice_mimetypes.indexOf(file.mimetype()) != -1) {
-            KZip zipfile(file.url().path());
-            KZipFileEntry *zipfileEntry;
-
-            if (zipfile.open(QIODevice::ReadOnly)) {
-                const KArchiveDirectory *zipfileContent = zipfile.directory();
-
-                if (koffice_mimetypes.indexOf(file.mimetype()) != -1) {
-                    zipfileEntry = (KZipFileEntry *)zipfileContent->entry(QStringLiteral("maindoc.xml"));
-                } else {
-                    zipfileEntry = (KZipFileEntry *)zipfileContent->entry(QStringLiteral("content.xml")); //for OpenOffice.org
-                }
-                if (!zipfileEntry) {
-                    qCWarning(KFING_LOG) << "Expected XML file not found in ZIP archive " << file.url();
-                    return;
-                }
-
-                zippedXmlFileContent = zipfileEntry->data();
-                xmlTags.setPattern(QStringLiteral("<.*>"));
-                xmlTags.setMinimal(true);
-                stream = new QTextStream(zippedXmlFileContent, QIODevice::ReadOnly);
-                stream->setCodec("UTF-8");
-                isZippedOfficeDocument = true;
-            } else {
-                qCWarning(KFING_LOG) << "Cannot open supposed ZIP file " << file.url();
-            }
-        } else if (!m_search_binary && !file.mimetype().startsWith(QLatin1String("text/"))
-                   && file.url().isLocalFile() && !file.url().path().startsWith(QLatin1String("/dev"))) {
-            if (KMimeType::isBinaryData(file.url().path())) {
-                return;
-            }
+void KQuery::addDuplicateCandidate(const KFileItem &file)
+{
+    m_duplicates->add(file.localPath(), file.size(), file.entry());
+}
+
+void KQuery::reportDuplicates()
+{
+    KFindTrace::Scope trace("reportDuplicates");
+    const QList<KQueryDuplicateGroup> groups = m_duplicates->groups();
+    // The paths are in the groups now
+    m_duplicates->cancel();
+
+    QList<KQueryResult> results;
+    for (const KQueryDuplicateGroup &group : groups) {
+        const QSharedPointer<const KQueryDuplicateGroup> shared(new KQueryDuplicateGroup(group));
+        for (int i = 0; i < group.paths.size(); i++) {
+            // Built from what was listed, as the items of other searches
+            KQueryResult result(KFileItem(group.entries.at(i), QUrl::fromLocalFile(group.paths.at(i))));
+            result.duplicates = shared;
+            results.append(result);
         }
+        KQueryStats::add(KQueryStats::FilesFound, group.paths.size());
 
-        if (!isZippedOfficeDocument) { //any other file or non-compressed KWord
-            filename = file.url().path();
-            if (filename.startsWith(QLatin1String("/dev/"))) {
-                return;
-            }
-            qf.setFileName(filename);
-            qf.open(QIODevice::ReadOnly);
-            stream = new QTextStream(&qf);
-            stream->setCodec(QTextCodec::codecForLocale());
+        // Whole groups only, every 100 files or so
+        if (results.size() >= 100) {
+            m_resultCount += results.size();
+            emit foundFileList(results);
+            results.clear();
         }
+    }
+    if (!results.isEmpty()) {
+        m_resultCount += results.size();
+        emit foundFileList(results);
+    }
+}
 
-        while (!stream->atEnd())
-        {
-            QString str = stream->readLine();
-            matchingLineNumber++;
+void KQuery::setFindDuplicates(bool findDuplicates)
+{
+    m_findDuplicates = findDuplicates;
+}
 
-            //If the stream ended (readLine().isNull() is true) the file was read completely
-            //Do *not* use isEmpty() because that will exit if there is an empty line in the file
-            if (str.isNull()) {
-                break;
-            }
-            if (isZippedOfficeDocument) {
-                str.remove(xmlTags);
-            }
+void KQuery::setCollapseHardLinks(bool collapseHardLinks)
+{
+    m_collapseHardLinks = collapseHardLinks;
+}
 
-            if (m_regexpForContent) {
-                if (m_regexp.indexIn(str) >= 0) {
-                    matchingLine = QString::number(matchingLineNumber)+QStringLiteral(": ")+str.trimmed();
-                    found = true;
-                    break;
-                }
-            } else {
-                if (str.indexOf(m_context, 0, m_casesensitive ? Qt::CaseSensitive : Qt::CaseInsensitive) != -1) {
-                    matchingLine = QString::number(matchingLineNumber)+QStringLiteral(": ")+str.trimmed();
-                    found = true;
-                    break;
-                }
-            }
-            qApp->processEvents();
-        }
+KQueryStats::Snapshot KQuery::statistics() const
+{
+    return KQueryStats::snapshot() - m_statsBaseline;
+}
 
-        delete stream;
+void KQuery::slotProgress()
+{
+    const KQueryStats::Snapshot now = KQueryStats::snapshot();
+    const KQueryStats::Snapshot delta = now - m_progressSnapshot;
+    m_progressSnapshot = now;
 
-        if (!found) {
-            return;
-        }
+    const double seconds = delta.elapsedNanos / 1e9;
+    if (seconds <= 0) {
+        return;
     }
 
-    m_foundFilesList.append(QPair<KFileItem, QString>(file, matchingLine));
+    KQueryProgress info;
+    info.filesPerSecond = delta.counters[KQueryStats::EntriesSeen] / seconds;
+    info.bytesPerSecond = delta.counters[KQueryStats::BytesRead] / seconds;
+    if (!m_useLocate) {
+        info.pendingDirs = m_walker->pendingDirs();
+        info.currentDir = m_walker->currentDir();
+        info.remainingTime = m_walker->estimatedRemainingTime();
+    }
+    emit progress(info);
+}
+
+void KQuery::reportStatistics()
+{
+    if (m_traceStart >= 0 && KFindTrace::isEnabled()) {
+        KFindTrace::complete("search", m_traceStart, KFindTrace::now());
+        m_traceStart = -1;
+    }
+
+    const QByteArray stats = statistics().toJson();
+    qCInfo(KFING_LOG) << "Search finished:" << stats.constData();
+
+    // Machine readable dump, one JSON object per search
+    const QString statsFile = QFile::decodeName(qgetenv("KFIND_STATS_FILE"));
+    if (!statsFile.isEmpty()) {
+        QFile file(statsFile);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            file.write(stats + '\n');
+        }
+    }
 }
 
 void KQuery::setContext(const QString &context, bool casesensitive, bool search_binary, bool useRegexp)
 {
-    m_context = context;
-    m_casesensitive = casesensitive;
-    m_search_binary = search_binary;
-    m_regexpForContent = useRegexp;
-    if (!m_regexpForContent) {
-        m_regexp.setPatternSyntax(QRegExp::Wildcard);
+    m_content.context = context;
+    m_content.caseSensitive = casesensitive;
+    m_content.searchBinary = search_binary;
+    m_content.useRegexp = useRegexp;
+    if (!m_content.useRegexp) {
+        m_content.regexp.setPatternSyntax(QRegExp::Wildcard);
     } else {
-        m_regexp.setPatternSyntax(QRegExp::RegExp);
+        m_content.regexp.setPatternSyntax(QRegExp::RegExp);
     }
     if (casesensitive) {
-        m_regexp.setCaseSensitivity(Qt::CaseSensitive);
+        m_content.regexp.setCaseSensitivity(Qt::CaseSensitive);
     } else {
-        m_regexp.setCaseSensitivity(Qt::CaseInsensitive);
+        m_content.regexp.setCaseSensitivity(Qt::CaseInsensitive);
     }
-    if (m_regexpForContent) {
-        m_regexp.setPattern(m_context);
+    if (m_content.useRegexp) {
+        m_content.regexp.setPattern(m_content.context);
     }
 }
 
+void KQuery::setAllMatches(bool allMatches, int contextLines)
+{
+    m_content.allMatches = allMatches;
+    m_content.contextLines = qMax(0, contextLines);
+}
+
+void KQuery::setSearchCompressed(bool searchCompressed)
+{
+    m_content.searchCompressed = searchCompressed;
+}
+
 void KQuery::setMetaInfo(const QString &metainfo, const QString &metainfokey)
 {
-    m_metainfo = metainfo;
-    m_metainfokey = metainfokey;
+    m_content.metainfo = metainfo;
+    m_content.metainfoKey = metainfokey;
+    m_content.metainfoKeyRegexp = QRegExp(metainfokey, Qt::CaseSensitive, QRegExp::Wildcard);
+}
+
+void KQuery::setChecksum(const QByteArray &checksum, QCryptographicHash::Algorithm algorithm, qint64 size)
+{
+    m_content.checksum = checksum;
+    m_content.checksumAlgorithm = algorithm;
+    m_checksumSize = checksum.isEmpty() ? -1 : size;
+}
+
+void KQuery::setChecksumXattr(bool useXattr)
+{
+    m_content.checksumXattr = useXattr;
+}
+
+bool KQuery::parseChecksum(const QString &text, QByteArray *checksum, QCryptographicHash::Algorithm *algorithm)
+{
+    const QByteArray hex = text.trimmed().toLatin1();
+    for (const char c : hex) {
+        if (!isxdigit(uchar(c))) {
+            return false;
+        }
+    }
+
+    switch (hex.size()) {
+    case 32:
+        *algorithm = QCryptographicHash::Md5;
+        break;
+    case 40:
+        *algorithm = QCryptographicHash::Sha1;
+        break;
+    case 64:
+        *algorithm = QCryptographicHash::Sha256;
+        break;
+    default:
+        return false;
+    }
+    *checksum = QByteArray::fromHex(hex);
+    return true;
 }
 
 void KQuery::setMimeType(const QStringList &mimetype)
@@ -569,6 +799,12 @@ void KQuery::setRecursive(bool recursive)
     m_recursive = recursive;
 }
 
+void KQuery::setDepthRange(int minDepth, int maxDepth)
+{
+    m_minDepth = minDepth;
+    m_maxDepth = maxDepth;
+}
+
 void KQuery::setPath(const QUrl &url)
 {
     m_url = url;
@@ -584,24 +820,88 @@ void KQuery::setShowHiddenFiles(bool showHidden)
     m_showHiddenFiles = showHidden;
 }
 
+void KQuery::setExcludedFolders(const QStringList &patterns)
+{
+    m_pruneRules.setExcludedFolders(patterns);
+}
+
+void KQuery::setUseIgnoreFiles(bool useIgnoreFiles)
+{
+    m_useIgnoreFiles = useIgnoreFiles;
+}
+
+void KQuery::setStayOnFilesystem(bool stayOnFilesystem)
+{
+    m_walker->setStayOnFilesystem(stayOnFilesystem);
+}
+
+void KQuery::setFollowSymlinks(bool followSymlinks)
+{
+    m_followSymlinks = followSymlinks;
+}
+
+void KQuery::setTestLinkTargets(bool testLinkTargets)
+{
+    m_testLinkTargets = testLinkTargets;
+}
+
+void KQuery::setNetworkMountLimits(int maxJobs, int timeout)
+{
+    m_walker->setNetworkMountLimits(maxJobs, timeout * 1000);
+}
+
+void KQuery::setSearchArchives(bool searchArchives)
+{
+    m_searchArchives = searchArchives;
+}
+
+void KQuery::setMaxResults(int maxResults)
+{
+    m_maxResults = qMax(0, maxResults);
+}
+
 void KQuery::slotreadyReadStandardError()
 {
-    KMessageBox::error(NULL, QString::fromLocal8Bit(processLocate->readAllStandardOutput()), i18nc("@title:window", "Error while using locate"));
+    const QString message = QString::fromLocal8Bit(processLocate->readAllStandardError());
+
+    // There are no widgets in headless mode
+    if (qobject_cast<QApplication *>(QCoreApplication::instance())) {
+        KMessageBox::error(NULL, message, i18nc("@title:window", "Error while using locate"));
+    } else {
+        qCWarning(KFING_LOG) << "Error while using locate:" << message;
+    }
 }
 
 void KQuery::slotreadyReadStandardOutput()
 {
-    bufferLocate += processLocate->readAllStandardOutput();
+    const QByteArray output = processLocate->readAllStandardOutput();
+    // Still arriving while locate is killed at the result limit
+    if (m_maxResults > 0 && m_resultCount >= m_maxResults) {
+        return;
+    }
+    bufferLocate += output;
+
+    // Complete lines are checked right away, so a result limit can stop
+    // locate early
+    const int end = bufferLocate.lastIndexOf('\n');
+    if (end < 0) {
+        return;
+    }
+    const QString str = QString::fromLocal8Bit(bufferLocate.constData(), end);
+    bufferLocate.remove(0, end + 1);
+    slotListEntries(str.split(QLatin1Char('\n'), QString::SkipEmptyParts));
 }
 
-void KQuery::slotendProcessLocate(int code, QProcess::ExitStatus)
+void KQuery::slotendProcessLocate(int code, QProcess::ExitStatus status)
 {
-    if (code == 0) {
+    if (code == 0 && status == QProcess::NormalExit) {
         if (!bufferLocate.isEmpty()) {
             QString str = QString::fromLocal8Bit(bufferLocate);
             bufferLocate.clear();
             slotListEntries(str.split(QLatin1Char('\n'), QString::SkipEmptyParts));
         }
     }
-    emit result(0);
+    bufferLocate.clear();
+    m_listing = false;
+    finishIfDone();
 }
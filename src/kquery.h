@@ -21,18 +21,45 @@
 
 #include <time.h>
 
+#include <QHash>
 #include <QObject>
+#include <QPair>
 #include <QRegExp>
 #include <QQueue>
 #include <QList>
 #include <QDir>
-#include <QPair>
 #include <QStringList>
 
 #include <kio/job.h>
 #include <kprocess.h>
 
+#include "kquerycontent.h"
+#include "kquerystats.h"
+#include "kquerywalker.h"
+
 class KFileItem;
+class KQueryArchiveLister;
+class KQueryDuplicateFinder;
+class QTimer;
+
+/* Where a running search is, published a few times a second */
+struct KQueryProgress {
+    KQueryProgress()
+        : filesPerSecond(0)
+        , bytesPerSecond(0)
+        , pendingDirs(0)
+        , remainingTime(-1)
+    {
+    }
+
+    double filesPerSecond;
+    double bytesPerSecond;
+    /* Folders queued or being listed */
+    int pendingDirs;
+    QUrl currentDir;
+    /* Milliseconds, -1 if unknown */
+    qint64 remainingTime;
+};
 
 class KQuery : public QObject
 {
@@ -47,15 +74,57 @@ public:
     void setTimeRange(time_t from, time_t to);
     void setRegExp(const QString &regexp, bool caseSensitive);
     void setRecursive(bool recursive);
+    /* Only entries this many levels below the folder searched, its own
+     * entries being level 1; maxDepth -1 is no limit. Folders below
+     * maxDepth are not listed, see KQueryWalker::setDepthRange(). */
+    void setDepthRange(int minDepth, int maxDepth);
     void setPath(const QUrl &url);
     void setFileType(int filetype);
     void setMimeType(const QStringList &mimetype);
     void setContext(const QString &context, bool casesensitive, bool search_binary, bool useRegexp);
+    /* Collect every matching line of the content search, each with
+     * contextLines lines around it */
+    void setAllMatches(bool allMatches, int contextLines);
+    /* Search the text of gzip, bzip2, xz and zstd compressed files */
+    void setSearchCompressed(bool);
     void setUsername(const QString &username);
     void setGroupname(const QString &groupname);
     void setMetaInfo(const QString &metainfo, const QString &metainfokey);
+    /* Only local files with this checksum, raw bytes, an empty one for
+     * any. size is that of a file known to have it, or -1; files of
+     * another size are then not read. */
+    void setChecksum(const QByteArray &checksum, QCryptographicHash::Algorithm algorithm, qint64 size = -1);
+    /* Keep the checksums computed in user.kfind.* extended attributes of
+     * the files, and trust the ones found there, see KQueryChecksumCache */
+    void setChecksumXattr(bool);
+    /* Reads a hexadecimal MD5, SHA-1 or SHA-256 checksum, told apart by
+     * their length */
+    static bool parseChecksum(const QString &text, QByteArray *checksum, QCryptographicHash::Algorithm *algorithm);
     void setUseFileIndex(bool);
     void setShowHiddenFiles(bool);
+    /* Folders matching these wildcards are not searched, see KQueryPruneRules */
+    void setExcludedFolders(const QStringList &patterns);
+    /* Skip what .gitignore and .ignore files ignore, see KQueryWalker */
+    void setUseIgnoreFiles(bool);
+    /* Do not descend into other file systems, like find -xdev */
+    void setStayOnFilesystem(bool);
+    /* Descend into links to folders, like find -L */
+    void setFollowSymlinks(bool);
+    /* Test the type and permissions of the file a link points to (the
+     * default), or else those of the link itself, like find -type */
+    void setTestLinkTargets(bool);
+    /* Report a file reached by several paths (hard links, bind mounts)
+     * once, see KQueryResult::otherLinks. Its content is searched once. */
+    void setCollapseHardLinks(bool);
+    /* Instead of every file passing the checks, report the groups of
+     * them with equal content, see KQueryResult::duplicates */
+    void setFindDuplicates(bool);
+    /* Cap and timeout, in seconds, for listing folders of network mounts */
+    void setNetworkMountLimits(int maxJobs, int timeout);
+    /* List the members of zip and tar archives found like folders */
+    void setSearchArchives(bool);
+    /* Stop the search after this many results, 0 for no limit */
+    void setMaxResults(int);
 
     void start();
     void kill();
@@ -64,6 +133,9 @@ public:
         return m_url;
     }
 
+    /* Counters of the current (or last) search */
+    KQueryStats::Snapshot statistics() const;
+
 private:
     /* Check if file meets the find's requirements*/
     inline void processQuery(const KFileItem &);
@@ -74,20 +146,42 @@ public Q_SLOTS:
 
 protected Q_SLOTS:
     /* List of files found using KIO */
-    void slotListEntries(KIO::Job *, const KIO::UDSEntryList &);
-    void slotResult(KJob *);
-    void slotCanceled(KJob *);
+    void slotListEntries(const QUrl &, const KIO::UDSEntryList &);
+    void slotResult(int);
+    void slotProgress();
+    void slotScanned(const QList<KQueryResult> &);
 
     void slotreadyReadStandardOutput();
     void slotreadyReadStandardError();
     void slotendProcessLocate(int, QProcess::ExitStatus);
 
 Q_SIGNALS:
-    void foundFileList(const QList< QPair<KFileItem, QString> > &);
+    void foundFileList(const QList<KQueryResult> &);
     void result(int);
+    void progress(const KQueryProgress &);
+    /* otherLinks of results already reported grew */
+    void otherLinksFound();
 
 private:
     void checkEntries();
+    /* True if file is another path to a file seen before, otherwise
+     * otherLinks is set to the count for the paths to come */
+    bool isOtherLink(const KFileItem &file, QSharedPointer<int> *otherLinks);
+    /* Whether a file found with locate is in a pruned folder below m_url */
+    bool isInPrunedFolder(const QString &path) const;
+    /* 1 for the entries of the searched folder, 0 if path is not below it */
+    int depthBelowRoot(const QString &path) const;
+    /* Whether a file found with locate is too shallow or too deep below m_url */
+    bool isOutsideDepthRange(const QString &path) const;
+    /* Emits result() once listing and scanning are both done */
+    void finishIfDone();
+    /* Stops listing and scanning once m_maxResults were found */
+    void stopAtLimit();
+    /* Passes a file passing the checks to the duplicate search */
+    void addDuplicateCandidate(const KFileItem &file);
+    /* Emits the groups of the duplicate search */
+    void reportDuplicates();
+    void reportStatistics();
 
     int m_filetype;
     int m_sizemode;
@@ -96,34 +190,55 @@ private:
     QUrl m_url;
     time_t m_timeFrom;
     time_t m_timeTo;
-    QRegExp m_regexp;// regexp for file content
     bool m_recursive;
+    int m_minDepth;
+    int m_maxDepth;
     QStringList m_mimetype;
-    QString m_context;
     QString m_username;
     QString m_groupname;
-    QString m_metainfo;
-    QString m_metainfokey;
-    bool m_casesensitive;
-    bool m_search_binary;
-    bool m_regexpForContent;
+    KQueryContentCriteria m_content;
+    // Of the files with the checksum searched, -1 if unknown
+    qint64 m_checksumSize;
     bool m_useLocate;
     bool m_showHiddenFiles;
+    KQueryPruneRules m_pruneRules;
+    bool m_useIgnoreFiles;
+    bool m_followSymlinks;
+    bool m_testLinkTargets;
+    bool m_collapseHardLinks;
+    // The files passing the checks so far by st_dev and st_ino, with
+    // their count of other paths
+    QHash<QPair<quint64, quint64>, QSharedPointer<int> > m_inodes;
+    // The count of the files being scanned, until they are reported
+    QHash<QUrl, QSharedPointer<int> > m_scannedLinks;
+    bool m_otherLinksFound;
+    int m_maxResults;
+    int m_resultCount;
     QByteArray bufferLocate;
     QStringList locateList;
     KProcess *processLocate;
     QList<QRegExp *> m_regexps;// regexps for file name
 //  QValueList<bool> m_regexpsContainsGlobs;  // what should this be good for ? Alex
-    KIO::ListJob *job;
+    KQueryWalker *m_walker;
+    KQueryContentScanner *m_scanner;
+    KQueryArchiveLister *m_archives;
+    KQueryDuplicateFinder *m_duplicates;
+    bool m_findDuplicates;
+    bool m_searchArchives;
     bool m_insideCheckEntries;
+    // A search was started and result() not emitted yet
+    bool m_running;
+    // The walker or locate still delivers entries
+    bool m_listing;
     QQueue<KFileItem> m_fileItems;
-    QRegExp metaKeyRx;
     int m_result;
-    QStringList ignore_mimetypes;
-    QStringList ooo_mimetypes;   // OpenOffice.org mimetypes
-    QStringList koffice_mimetypes;
 
-    QList< QPair<KFileItem, QString> > m_foundFilesList;
+    QList<KQueryResult> m_foundFilesList;
+
+    KQueryStats::Snapshot m_statsBaseline;
+    KQueryStats::Snapshot m_progressSnapshot;
+    QTimer *m_progressTimer;
+    qint64 m_traceStart;
 };
 
 #endif
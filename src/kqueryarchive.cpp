@@ -0,0 +1,426 @@
+/*******************************************************************
+* kqueryarchive.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kqueryarchive.h"
+#include "kfind_debug.h"
+#include "kfindtrace.h"
+#include "kqueryignore.h"
+#include "kquerystats.h"
+
+#include <sys/stat.h>
+
+#include <QFileInfo>
+#include <QHash>
+#include <QMimeDatabase>
+#include <QRunnable>
+#include <QWeakPointer>
+
+#include <karchivedirectory.h>
+#include <karchivefile.h>
+#include <ktar.h>
+#include <kzip.h>
+
+// Members reported at once, so a huge archive shows up while it is listed
+static const int batchSize = 1000;
+
+static bool isZipMimeType(const QString &name)
+{
+    return name == QLatin1String("application/zip") || name == QLatin1String("application/x-java-archive");
+}
+
+static QString archiveMimeType(const QString &fileName)
+{
+    // Office documents are zip files too, but have mime types of their own
+    static const char *const tarMimeTypes[] = {
+        "application/x-tar",
+        "application/x-compressed-tar",
+        "application/x-bzip-compressed-tar",
+        "application/x-xz-compressed-tar",
+        "application/x-zstd-compressed-tar"
+    };
+
+    const QString name = QMimeDatabase().mimeTypeForFile(fileName, QMimeDatabase::MatchExtension).name();
+    if (isZipMimeType(name)) {
+        return name;
+    }
+    for (const char *tarMimeType : tarMimeTypes) {
+        if (name == QLatin1String(tarMimeType)) {
+            return name;
+        }
+    }
+    return QString();
+}
+
+static KArchive *openArchive(const QString &path)
+{
+    QScopedPointer<KArchive> archive;
+    if (isZipMimeType(archiveMimeType(path))) {
+        archive.reset(new KZip(path));
+    } else {
+        archive.reset(new KTar(path));
+    }
+
+    if (!archive->open(QIODevice::ReadOnly)) {
+        qCDebug(KFING_LOG) << "Cannot open archive" << path << archive->errorString();
+        return nullptr;
+    }
+    return archive.take();
+}
+
+namespace {
+
+// Archives in use, an archive closes once nobody holds it anymore
+struct OpenArchives {
+    QMutex mutex;
+    QHash<QString, QWeakPointer<KQueryOpenArchive> > archives;
+};
+
+}
+
+Q_GLOBAL_STATIC(OpenArchives, openArchives)
+
+class KQueryArchiveTask : public QRunnable
+{
+public:
+    KQueryArchiveTask(KQueryArchiveLister *lister, int generation, const QString &path, int depth)
+        : m_lister(lister)
+        , m_generation(generation)
+        , m_path(path)
+        , m_depth(depth)
+        , m_recursive(lister->m_recursive)
+        , m_minDepth(lister->m_minDepth)
+        , m_maxDepth(lister->m_maxDepth)
+        , m_pruneRules(lister->m_pruneRules)
+        , m_useIgnoreFiles(lister->m_useIgnoreFiles)
+        , m_search(KQueryStats::currentSearch())
+    {
+        // Shared QRegExp objects must not be used from several threads
+        m_pruneRules.excludedNames.detach();
+        m_pruneRules.excludedPaths.detach();
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        if (m_lister->isCanceled(m_generation)) {
+            return;
+        }
+
+        KQueryStats::SearchScope stats(m_search);
+
+        KFindTrace::Scope trace("listArchive");
+        m_scheme = isZipMimeType(archiveMimeType(m_path)) ? QStringLiteral("zip") : QStringLiteral("tar");
+        m_url.setScheme(m_scheme);
+        m_url.setPath(m_path);
+
+        if (m_useIgnoreFiles) {
+            // The rules of the folders down to the one of the archive
+            m_ignoreRules = KQueryIgnoreRules::loadAbove(m_path);
+        }
+
+        // Only the directory of a zip is read, a compressed tar is
+        // decompressed to a temporary file by KTar though. Both stay open
+        // for the content scans of the members.
+        const KQueryOpenArchive::Ptr archive = KQueryArchiveLister::sharedArchive(m_path);
+        // Members below the deepest level wanted are not listed at all
+        if (archive->archive && (m_maxDepth < 0 || m_depth < m_maxDepth)) {
+            KQueryStats::add(KQueryStats::ArchivesListed);
+            m_lister->keepOpen(m_generation, archive);
+            // The directory does not change once open, no lock needed
+            listDirectory(archive->archive->directory(), QString(), m_depth + 1);
+        }
+        m_lister->listed(m_generation, m_url, m_entries, true);
+    }
+
+private:
+    /* The members of dir are at depth, like the entries of a folder */
+    void listDirectory(const KArchiveDirectory *dir, const QString &prefix, int depth)
+    {
+        if (m_lister->isCanceled(m_generation)) {
+            return;
+        }
+
+        const QStringList names = dir->entries();
+        for (const QString &name : names) {
+            const KArchiveEntry *entry = dir->entry(name);
+            if (!entry) {
+                continue;
+            }
+            const QString path = prefix + name;
+            if (isIgnored(entry, name, path)) {
+                KQueryStats::add(KQueryStats::IgnoredEntries);
+                continue;
+            }
+            if (depth >= m_minDepth) {
+                m_entries.append(udsEntry(entry, path));
+                if (m_entries.size() == batchSize) {
+                    m_lister->listed(m_generation, m_url, m_entries, false);
+                    m_entries.clear();
+                }
+            }
+            if (!m_recursive || !entry->isDirectory() || (m_maxDepth >= 0 && depth >= m_maxDepth)) {
+                continue;
+            }
+            // Pruned folders are still reported as entries, just not listed
+            if (!m_pruneRules.isEmpty() && m_pruneRules.isPruned(name, m_path + QLatin1Char('/') + path)) {
+                KQueryStats::add(KQueryStats::DirsPruned);
+                continue;
+            }
+            listDirectory(static_cast<const KArchiveDirectory *>(entry), path + QLatin1Char('/'), depth + 1);
+        }
+    }
+
+    bool isIgnored(const KArchiveEntry *entry, const QString &name, const QString &path) const
+    {
+        if (!m_useIgnoreFiles) {
+            return false;
+        }
+        // Nothing in there is part of the checkout
+        if (name == QLatin1String(".git")) {
+            return true;
+        }
+        return m_ignoreRules && m_ignoreRules->isIgnored(m_path + QLatin1Char('/') + path, entry->isDirectory());
+    }
+
+    KIO::UDSEntry udsEntry(const KArchiveEntry *entry, const QString &path) const
+    {
+        KIO::UDSEntry uds;
+        uds.insert(KIO::UDSEntry::UDS_NAME, entry->name());
+
+        QUrl url;
+        url.setScheme(m_scheme);
+        url.setPath(m_path + QLatin1Char('/') + path);
+        uds.insert(KIO::UDSEntry::UDS_URL, url.toString());
+
+        mode_t type = S_IFREG;
+        if (!entry->symLinkTarget().isEmpty()) {
+            type = S_IFLNK;
+            uds.insert(KIO::UDSEntry::UDS_LINK_DEST, entry->symLinkTarget());
+        } else if (entry->isDirectory()) {
+            type = S_IFDIR;
+        }
+        uds.insert(KIO::UDSEntry::UDS_FILE_TYPE, type);
+        uds.insert(KIO::UDSEntry::UDS_ACCESS, entry->permissions() & 07777);
+        if (entry->isFile()) {
+            uds.insert(KIO::UDSEntry::UDS_SIZE, static_cast<const KArchiveFile *>(entry)->size());
+        }
+        uds.insert(KIO::UDSEntry::UDS_MODIFICATION_TIME, entry->date().toTime_t());
+        uds.insert(KIO::UDSEntry::UDS_USER, entry->user());
+        uds.insert(KIO::UDSEntry::UDS_GROUP, entry->group());
+        return uds;
+    }
+
+    KQueryArchiveLister *m_lister;
+    int m_generation;
+    QString m_path;
+    int m_depth;
+    bool m_recursive;
+    int m_minDepth;
+    int m_maxDepth;
+    KQueryPruneRules m_pruneRules;
+    bool m_useIgnoreFiles;
+    KQueryIgnoreRules::Ptr m_ignoreRules;
+    int m_search;
+    QString m_scheme;
+    QUrl m_url;
+    KIO::UDSEntryList m_entries;
+};
+
+KQueryArchiveLister::KQueryArchiveLister(QObject *parent)
+    : QObject(parent)
+    , m_recursive(true)
+    , m_minDepth(1)
+    , m_maxDepth(-1)
+    , m_useIgnoreFiles(false)
+    , m_pending(0)
+    , m_finished(0)
+{
+}
+
+KQueryArchiveLister::~KQueryArchiveLister()
+{
+    // The listings point to this object, they stop at their next check
+    cancel();
+    m_pool.waitForDone();
+}
+
+bool KQueryArchiveLister::isArchive(const QString &fileName)
+{
+    return !archiveMimeType(fileName).isEmpty();
+}
+
+KQueryOpenArchive::Ptr KQueryArchiveLister::sharedArchive(const QString &path)
+{
+    KQueryOpenArchive::Ptr archive;
+    {
+        QMutexLocker locker(&openArchives->mutex);
+        archive = openArchives->archives.value(path).toStrongRef();
+        if (!archive) {
+            archive.reset(new KQueryOpenArchive);
+            openArchives->archives.insert(path, archive);
+        }
+    }
+
+    // Opened by the first to get here, the others wait for this archive only
+    QMutexLocker locker(&archive->mutex);
+    if (!archive->opened) {
+        archive->opened = true;
+        archive->archive.reset(openArchive(path));
+    }
+    return archive;
+}
+
+bool KQueryArchiveLister::splitMemberUrl(const QUrl &url, QString *archivePath, QString *memberPath)
+{
+    if (url.scheme() != QLatin1String("zip") && url.scheme() != QLatin1String("tar")) {
+        return false;
+    }
+
+    // The archive is the first part of the path that is a file
+    const QString path = url.path();
+    for (int slash = path.indexOf(QLatin1Char('/'), 1); slash != -1; slash = path.indexOf(QLatin1Char('/'), slash + 1)) {
+        const QString prefix = path.left(slash);
+        if (QFileInfo(prefix).isFile()) {
+            *archivePath = prefix;
+            *memberPath = path.mid(slash + 1);
+            return !memberPath->isEmpty();
+        }
+    }
+    return false;
+}
+
+void KQueryArchiveLister::setRecursive(bool recursive)
+{
+    m_recursive = recursive;
+}
+
+void KQueryArchiveLister::setDepthRange(int minDepth, int maxDepth)
+{
+    m_minDepth = minDepth;
+    m_maxDepth = maxDepth;
+}
+
+void KQueryArchiveLister::setPruneRules(const KQueryPruneRules &rules)
+{
+    m_pruneRules = rules;
+}
+
+void KQueryArchiveLister::setUseIgnoreFiles(bool useIgnoreFiles)
+{
+    m_useIgnoreFiles = useIgnoreFiles;
+}
+
+void KQueryArchiveLister::list(const QString &archivePath, int depth)
+{
+    m_pending++;
+    m_pool.start(new KQueryArchiveTask(this, m_generation.load(), archivePath, depth));
+}
+
+void KQueryArchiveLister::cancel()
+{
+    m_generation.ref();
+    m_pool.clear();
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_listed.clear();
+        m_finished = 0;
+        m_pending = 0;
+    }
+    closeArchives();
+}
+
+void KQueryArchiveLister::closeArchives()
+{
+    QList<KQueryOpenArchive::Ptr> open;
+    {
+        QMutexLocker locker(&m_mutex);
+        open.swap(m_open);
+    }
+    // Running scans of members still hold theirs
+    open.clear();
+
+    QMutexLocker locker(&openArchives->mutex);
+    QHash<QString, QWeakPointer<KQueryOpenArchive> >::iterator it = openArchives->archives.begin();
+    while (it != openArchives->archives.end()) {
+        if (it.value().isNull()) {
+            it = openArchives->archives.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+int KQueryArchiveLister::pendingCount() const
+{
+    return m_pending;
+}
+
+void KQueryArchiveLister::listed(int generation, const QUrl &url, const KIO::UDSEntryList &entries, bool done)
+{
+    QMutexLocker locker(&m_mutex);
+    if (isCanceled(generation)) {
+        return;
+    }
+
+    // One queued call delivers everything listed until it runs
+    if (m_finished == 0 && m_listed.isEmpty()) {
+        QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
+    }
+    if (done) {
+        m_finished++;
+    }
+    if (!entries.isEmpty()) {
+        Listed part;
+        part.url = url;
+        part.entries = entries;
+        m_listed.append(part);
+    }
+}
+
+void KQueryArchiveLister::keepOpen(int generation, const KQueryOpenArchive::Ptr &archive)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!isCanceled(generation)) {
+        m_open.append(archive);
+    }
+}
+
+void KQueryArchiveLister::deliver()
+{
+    QList<Listed> listed;
+    int finished;
+    {
+        QMutexLocker locker(&m_mutex);
+        listed.swap(m_listed);
+        finished = m_finished;
+        m_finished = 0;
+    }
+
+    // Reaching the result limit while the entries are checked cancels
+    const int generation = m_generation.load();
+    for (const Listed &part : qAsConst(listed)) {
+        emit entries(part.url, part.entries);
+        if (isCanceled(generation)) {
+            return;
+        }
+    }
+    m_pending -= finished;
+    if (m_pending == 0 && finished > 0) {
+        emit idle();
+    }
+}
@@ -0,0 +1,137 @@
+/*******************************************************************
+* kqueryarchive.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYARCHIVE_H
+#define KQUERYARCHIVE_H
+
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QUrl>
+
+#include <karchive.h>
+#include <kio/udsentry.h>
+
+#include "kquerywalker.h"
+
+/* An archive opened once and shared by the threads listing and searching
+ * its members. The members are all read through the one device of the
+ * archive, so only while mutex is locked. */
+struct KQueryOpenArchive {
+    typedef QSharedPointer<KQueryOpenArchive> Ptr;
+
+    KQueryOpenArchive()
+        : opened(false)
+    {
+    }
+
+    QMutex mutex;
+    // Null if the file could not be opened as an archive
+    QScopedPointer<KArchive> archive;
+    bool opened;
+};
+
+/* Lists the members of zip and tar archives on a thread pool, so they
+ * can be searched like the files of a folder.
+ *
+ * Only the archive directory is read, nothing is extracted. Members get
+ * zip:/ or tar:/ URLs, /path/archive.zip/member, which the zip and tar
+ * KIO slaves open too. Cancellation works like KQueryContentScanner.
+ *
+ * The members are filtered like the files of a folder by KQueryWalker,
+ * the archive counting as a folder. Each archive is opened once for the
+ * search, the content scans of its members use it too. */
+class KQueryArchiveLister : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KQueryArchiveLister(QObject *parent = nullptr);
+    ~KQueryArchiveLister();
+
+    /* By name, archives are not looked into to tell */
+    static bool isArchive(const QString &fileName);
+    /* The archive at path, shared with everyone using it already */
+    static KQueryOpenArchive::Ptr sharedArchive(const QString &path);
+    /* Splits a member URL into the archive file and the path inside it */
+    static bool splitMemberUrl(const QUrl &url, QString *archivePath, QString *memberPath);
+
+    /* Whether members in folders of the archives are listed too */
+    void setRecursive(bool recursive);
+    /* Of the members, the archive root is one below the archive */
+    void setDepthRange(int minDepth, int maxDepth);
+    void setPruneRules(const KQueryPruneRules &rules);
+    /* The ignore files of the folders of the archives apply to the members */
+    void setUseIgnoreFiles(bool useIgnoreFiles);
+    /* depth is the depth of the archive below the searched folder */
+    void list(const QString &archivePath, int depth);
+    /* Drops queued listings and stops running ones */
+    void cancel();
+    /* Lets go of the archives opened, once their members are searched */
+    void closeArchives();
+    /* Archives queued and not yet reported */
+    int pendingCount() const;
+
+    bool isCanceled(int generation) const
+    {
+        return m_generation.load() != generation;
+    }
+
+Q_SIGNALS:
+    /* Members of the archive at url, possibly in several parts */
+    void entries(const QUrl &url, const KIO::UDSEntryList &list);
+    /* Every archive queued has been listed */
+    void idle();
+
+private Q_SLOTS:
+    void deliver();
+
+private:
+    friend class KQueryArchiveTask;
+
+    struct Listed {
+        QUrl url;
+        KIO::UDSEntryList entries;
+    };
+
+    /* Called from the pool threads, done is set with the last part */
+    void listed(int generation, const QUrl &url, const KIO::UDSEntryList &entries, bool done);
+    /* Keeps archive open until closeArchives() */
+    void keepOpen(int generation, const KQueryOpenArchive::Ptr &archive);
+
+    QThreadPool m_pool;
+    QAtomicInt m_generation;
+    bool m_recursive;
+    int m_minDepth;
+    int m_maxDepth;
+    KQueryPruneRules m_pruneRules;
+    bool m_useIgnoreFiles;
+    int m_pending;
+
+    // Filled by the pool threads, emptied by deliver()
+    QMutex m_mutex;
+    QList<Listed> m_listed;
+    int m_finished;
+    QList<KQueryOpenArchive::Ptr> m_open;
+};
+
+#endif
@@ -0,0 +1,137 @@
+/*******************************************************************
+* kquerybytesearch.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kquerybytesearch.h"
+
+#include <string.h>
+
+#include <QtAlgorithms>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+// Bytes compared at once
+static const int vectorSize = 16;
+
+static inline __m128i foldAscii(__m128i bytes)
+{
+    // Bytes over 0x7f are negative, so they are never taken for letters
+    const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+                                        _mm_cmplt_epi8(bytes, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+static inline char foldAscii(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? char(c | 0x20) : c;
+}
+
+KQueryByteSearch::KQueryByteSearch()
+    : m_caseInsensitive(false)
+{
+}
+
+void KQueryByteSearch::setPattern(const QByteArray &pattern, bool caseInsensitive)
+{
+    m_caseInsensitive = caseInsensitive;
+    m_pattern = pattern;
+    if (caseInsensitive) {
+        for (int i = 0; i < m_pattern.size(); i++) {
+            m_pattern[i] = foldAscii(m_pattern.at(i));
+        }
+    }
+    m_matcher.setPattern(m_pattern);
+}
+
+bool KQueryByteSearch::matchesAt(const char *data) const
+{
+    const char *pattern = m_pattern.constData();
+    const int length = m_pattern.size();
+    if (!m_caseInsensitive) {
+        return memcmp(data, pattern, size_t(length)) == 0;
+    }
+    for (int i = 0; i < length; i++) {
+        if (foldAscii(data[i]) != pattern[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int KQueryByteSearch::indexIn(const char *data, int length, int from) const
+{
+    const int patternLength = m_pattern.size();
+    if (patternLength == 0) {
+        return from <= length ? from : -1;
+    }
+
+    int i = from;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(m_pattern.at(0));
+    const __m128i last = _mm_set1_epi8(m_pattern.at(patternLength - 1));
+    for (; i + patternLength - 1 + vectorSize <= length; i += vectorSize) {
+        __m128i firstBytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i lastBytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + patternLength - 1));
+        if (m_caseInsensitive) {
+            firstBytes = foldAscii(firstBytes);
+            lastBytes = foldAscii(lastBytes);
+        }
+
+        uint candidates = uint(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(firstBytes, first),
+                                                               _mm_cmpeq_epi8(lastBytes, last))));
+        while (candidates != 0) {
+            const int candidate = i + int(qCountTrailingZeroBits(candidates));
+            if (matchesAt(data + candidate)) {
+                return candidate;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+#else
+    if (!m_caseInsensitive) {
+        return m_matcher.indexIn(data, length, from);
+    }
+#endif
+
+    for (; i + patternLength <= length; i++) {
+        if (matchesAt(data + i)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool KQueryByteSearch::isAscii(const char *data, int length)
+{
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + vectorSize <= length; i += vectorSize) {
+        // The sign bits are those of the non-ASCII bytes
+        if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i))) != 0) {
+            return false;
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        if (uchar(data[i]) >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+/*******************************************************************
+* kquerybytesearch.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYBYTESEARCH_H
+#define KQUERYBYTESEARCH_H
+
+#include <QByteArray>
+#include <QByteArrayMatcher>
+
+/* Finds a byte string, optionally ignoring the case of ASCII letters.
+ *
+ * With SSE2, 16 positions are tested at once by comparing their first
+ * and last byte with those of the pattern, ASCII letters folded to
+ * lower case in the same step. Only the positions passing that test are
+ * compared completely, so ignoring case costs little. */
+class KQueryByteSearch
+{
+public:
+    KQueryByteSearch();
+
+    void setPattern(const QByteArray &pattern, bool caseInsensitive);
+
+    /* -1 if not found */
+    int indexIn(const char *data, int length, int from = 0) const;
+
+    static bool isAscii(const char *data, int length);
+
+private:
+    bool matchesAt(const char *data) const;
+
+    // Folded to lower case if m_caseInsensitive
+    QByteArray m_pattern;
+    bool m_caseInsensitive;
+    QByteArrayMatcher m_matcher;
+};
+
+#endif
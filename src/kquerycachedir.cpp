@@ -0,0 +1,156 @@
+/*******************************************************************
+* kquerycachedir.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kquerycachedir.h"
+#include "kfind_debug.h"
+
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+
+KQueryCacheDir::KQueryCacheDir(const QString &name, const QString &suffix, int version, qint64 maxSize)
+    : m_name(name)
+    , m_suffix(suffix)
+    , m_version(version)
+    , m_maxSize(maxSize)
+{
+}
+
+QString KQueryCacheDir::key(const QString &path) const
+{
+    return key(m_version, path);
+}
+
+static long modificationNanoseconds(const struct stat &buf)
+{
+#if defined(Q_OS_LINUX)
+    return buf.st_mtim.tv_nsec;
+#elif defined(Q_OS_DARWIN) || defined(Q_OS_FREEBSD) || defined(Q_OS_NETBSD) || defined(Q_OS_OPENBSD)
+    return buf.st_mtimespec.tv_nsec;
+#else
+    Q_UNUSED(buf);
+    return 0;
+#endif
+}
+
+QString KQueryCacheDir::key(int version, const QString &path)
+{
+    struct stat buf;
+    if (::stat(QFile::encodeName(path).constData(), &buf) != 0) {
+        return QString();
+    }
+
+    // A file rewritten within the same second keeps its modification time
+    // in seconds, its status change time tells when it was set back
+    return QString::number(version) + QLatin1Char('-')
+           + QString::number(qulonglong(buf.st_dev), 16) + QLatin1Char('-')
+           + QString::number(qulonglong(buf.st_ino), 16) + QLatin1Char('-')
+           + QString::number(qlonglong(buf.st_ctime), 16) + QLatin1Char('-')
+           + QString::number(qlonglong(buf.st_mtime), 16) + QLatin1Char('-')
+           + QString::number(qlonglong(modificationNanoseconds(buf)), 16) + QLatin1Char('-')
+           + QString::number(qlonglong(buf.st_size), 16);
+}
+
+QFile *KQueryCacheDir::open(const QString &key) const
+{
+    if (key.isEmpty()) {
+        return nullptr;
+    }
+
+    QFile *file = new QFile(path() + key + m_suffix);
+    if (!file->open(QIODevice::ReadOnly)) {
+        delete file;
+        return nullptr;
+    }
+
+    // The modification time tells prune() which entries were used last
+    ::utimes(QFile::encodeName(file->fileName()).constData(), nullptr);
+    return file;
+}
+
+QSaveFile *KQueryCacheDir::create(const QString &key) const
+{
+    if (key.isEmpty()) {
+        return nullptr;
+    }
+
+    const QString dir = path();
+    if (!QDir().mkpath(dir)) {
+        return nullptr;
+    }
+
+    QSaveFile *file = new QSaveFile(dir + key + m_suffix);
+    if (!file->open(QIODevice::WriteOnly)) {
+        qCDebug(KFING_LOG) << "Cannot write to the cache" << m_name << file->errorString();
+        delete file;
+        return nullptr;
+    }
+    return file;
+}
+
+void KQueryCacheDir::prune() const
+{
+    // Files being written have another suffix and are left alone
+    QFileInfoList entries = QDir(path()).entryInfoList(QStringList() << QLatin1Char('*') + m_suffix, QDir::Files);
+
+    qint64 total = 0;
+    for (const QFileInfo &entry : qAsConst(entries)) {
+        total += entry.size();
+    }
+    if (total <= m_maxSize) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const QFileInfo &a, const QFileInfo &b) {
+        return a.lastModified() < b.lastModified();
+    });
+
+    const qint64 target = pruneTarget(m_maxSize);
+    for (const QFileInfo &entry : qAsConst(entries)) {
+        if (total <= target) {
+            break;
+        }
+        if (QFile::remove(entry.absoluteFilePath())) {
+            total -= entry.size();
+        }
+    }
+}
+
+qint64 KQueryCacheDir::pruneTarget(qint64 maxSize)
+{
+    // Well below the limit, so pruning does not run again at every search
+    return maxSize / 4 * 3;
+}
+
+QString KQueryCacheDir::location()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+}
+
+QString KQueryCacheDir::path() const
+{
+    return location() + QLatin1Char('/') + m_name + QLatin1Char('/');
+}
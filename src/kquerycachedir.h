@@ -0,0 +1,72 @@
+/*******************************************************************
+* kquerycachedir.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYCACHEDIR_H
+#define KQUERYCACHEDIR_H
+
+#include <QString>
+
+class QFile;
+class QSaveFile;
+
+/* A folder of the cache location holding one file per entry, shared by
+ * the caches of what was computed from file contents.
+ *
+ * An entry is keyed by the device, inode, status change time,
+ * modification time to the nanosecond and size of the file it was
+ * computed from, so a changed file simply misses. The key starts with the
+ * version of the cache, to be bumped when what is stored changes, so that
+ * old entries are never hit, and ends with the modification time and size
+ * in three fields. Opening an entry marks it as used, prune() removes the
+ * least recently used ones.
+ * All functions can be called from any thread. */
+class KQueryCacheDir
+{
+public:
+    /* Entries are the files name/<key><suffix>, of maxSize bytes in all */
+    KQueryCacheDir(const QString &name, const QString &suffix, int version, qint64 maxSize);
+
+    /* Empty if the file cannot be stat'ed */
+    QString key(const QString &path) const;
+    /* The same for caches that do not keep their entries in a folder */
+    static QString key(int version, const QString &path);
+
+    /* The entry opened for reading, nullptr on a miss */
+    QFile *open(const QString &key) const;
+    /* A file to write the entry to, it is only kept once committed.
+     * nullptr if the cache cannot be written. */
+    QSaveFile *create(const QString &key) const;
+
+    /* Removes the least recently used entries over the size limit */
+    void prune() const;
+    /* The size a cache over its limit is cut down to */
+    static qint64 pruneTarget(qint64 maxSize);
+
+    /* Where all caches are */
+    static QString location();
+
+private:
+    QString path() const;
+
+    QString m_name;
+    QString m_suffix;
+    int m_version;
+    qint64 m_maxSize;
+};
+
+#endif
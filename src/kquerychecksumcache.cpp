@@ -0,0 +1,250 @@
+/*******************************************************************
+* kquerychecksumcache.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kquerychecksumcache.h"
+#include "kfind_debug.h"
+#include "kquerycachedir.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef Q_OS_LINUX
+#include <sys/xattr.h>
+#endif
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSaveFile>
+#include <QSet>
+
+static const int cacheVersion = 2;
+// An entry takes about 110 bytes, in memory about as much again
+static const qint64 maxLogSize = 16 * 1024 * 1024;
+
+namespace {
+
+/* The log as read into memory, keyed by "algorithm key" */
+struct Log {
+    Log()
+        : loaded(false)
+    {
+    }
+
+    QMutex mutex;
+    bool loaded;
+    QHash<QByteArray, QByteArray> checksums;
+};
+
+}
+
+Q_GLOBAL_STATIC(Log, checksumLog)
+
+static QString logPath()
+{
+    return KQueryCacheDir::location() + QLatin1String("/checksums.log");
+}
+
+static QByteArray entryKey(QCryptographicHash::Algorithm algorithm, const QString &key)
+{
+    return KQueryChecksumCache::algorithmName(algorithm).toLatin1() + ' ' + key.toLatin1();
+}
+
+/* Complete lines only, a line cut short by a crash has no line break.
+ * Called with the mutex held. */
+static QList<QByteArray> readLog()
+{
+    QFile file(logPath());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QList<QByteArray>();
+    }
+    QList<QByteArray> lines = file.readAll().split('\n');
+    lines.removeLast();
+    return lines;
+}
+
+static void loadLog(Log *log)
+{
+    if (log->loaded) {
+        return;
+    }
+    log->loaded = true;
+
+    const QList<QByteArray> lines = readLog();
+    for (const QByteArray &line : lines) {
+        // The rest of a cut line runs into the next one, which then has
+        // too many fields
+        const QList<QByteArray> fields = line.split(' ');
+        if (fields.size() == 3 && !fields.at(2).isEmpty()) {
+            log->checksums.insert(fields.at(0) + ' ' + fields.at(1), QByteArray::fromHex(fields.at(2)));
+        }
+    }
+}
+
+#ifdef Q_OS_LINUX
+static QByteArray xattrName(QCryptographicHash::Algorithm algorithm)
+{
+    return "user.kfind." + KQueryChecksumCache::algorithmName(algorithm).toLatin1();
+}
+#endif
+
+/* The modification time and size part of a key. The device and inode are
+ * left out of the extended attribute, it is only read from the file it
+ * was written to, and copies that keep it also keep the content. So is
+ * the status change time, setting the attribute changes it. */
+static QByteArray xattrStamp(const QString &key)
+{
+    return key.section(QLatin1Char('-'), -3).toLatin1();
+}
+
+QString KQueryChecksumCache::key(const QString &path)
+{
+    return KQueryCacheDir::key(cacheVersion, path);
+}
+
+bool KQueryChecksumCache::load(const QString &path, const QString &key, QCryptographicHash::Algorithm algorithm,
+                               QByteArray *checksum, bool useXattr)
+{
+    if (key.isEmpty()) {
+        return false;
+    }
+
+    if (useXattr) {
+#ifdef Q_OS_LINUX
+        char value[256];
+        const ssize_t length = ::getxattr(QFile::encodeName(path).constData(), xattrName(algorithm).constData(),
+                                          value, sizeof(value));
+        if (length > 0) {
+            const QByteArray stored(value, int(length));
+            const int space = stored.indexOf(' ');
+            if (space > 0 && stored.left(space) == xattrStamp(key)) {
+                *checksum = QByteArray::fromHex(stored.mid(space + 1));
+                return true;
+            }
+        }
+#else
+        Q_UNUSED(path);
+#endif
+    }
+
+    Log *log = checksumLog();
+    QMutexLocker locker(&log->mutex);
+    loadLog(log);
+    QHash<QByteArray, QByteArray>::const_iterator it = log->checksums.constFind(entryKey(algorithm, key));
+    if (it == log->checksums.constEnd()) {
+        return false;
+    }
+    *checksum = *it;
+    return true;
+}
+
+void KQueryChecksumCache::store(const QString &path, const QString &key, QCryptographicHash::Algorithm algorithm,
+                                const QByteArray &checksum, bool useXattr)
+{
+    if (key.isEmpty()) {
+        return;
+    }
+
+    if (useXattr) {
+#ifdef Q_OS_LINUX
+        // Changes the status change time of the file, not its modification time
+        const QByteArray value = xattrStamp(key) + ' ' + checksum.toHex();
+        if (::setxattr(QFile::encodeName(path).constData(), xattrName(algorithm).constData(),
+                       value.constData(), size_t(value.size()), 0) == 0) {
+            return;
+        }
+        qCDebug(KFING_LOG) << "Cannot set the checksum attribute of" << path << strerror(errno);
+#else
+        Q_UNUSED(path);
+#endif
+    }
+
+    Log *log = checksumLog();
+    QMutexLocker locker(&log->mutex);
+    loadLog(log);
+    const QByteArray entry = entryKey(algorithm, key);
+    log->checksums.insert(entry, checksum);
+
+    const QString fileName = logPath();
+    if (!QDir().mkpath(QFileInfo(fileName).path())) {
+        return;
+    }
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCDebug(KFING_LOG) << "Cannot write to the checksum cache" << file.errorString();
+        return;
+    }
+    file.write(entry + ' ' + checksum.toHex() + '\n');
+}
+
+void KQueryChecksumCache::prune()
+{
+    Log *log = checksumLog();
+    QMutexLocker locker(&log->mutex);
+    if (QFileInfo(logPath()).size() <= maxLogSize) {
+        return;
+    }
+
+    // The last entry of a key is the newest, the newest entries are kept
+    const QList<QByteArray> lines = readLog();
+    const qint64 target = KQueryCacheDir::pruneTarget(maxLogSize);
+    QSet<QByteArray> seen;
+    QList<QByteArray> kept;
+    qint64 size = 0;
+    for (int i = lines.size() - 1; i >= 0; i--) {
+        const QByteArray &line = lines.at(i);
+        const int space = line.lastIndexOf(' ');
+        if (space <= 0 || seen.contains(line.left(space))) {
+            continue;
+        }
+        if (size + line.size() + 1 > target) {
+            break;
+        }
+        seen.insert(line.left(space));
+        kept.prepend(line);
+        size += line.size() + 1;
+    }
+
+    QSaveFile file(logPath());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCDebug(KFING_LOG) << "Cannot write to the checksum cache" << file.errorString();
+        return;
+    }
+    for (const QByteArray &line : qAsConst(kept)) {
+        file.write(line + '\n');
+    }
+    if (file.commit()) {
+        log->checksums.clear();
+        log->loaded = false;
+    }
+}
+
+QString KQueryChecksumCache::algorithmName(QCryptographicHash::Algorithm algorithm)
+{
+    switch (algorithm) {
+    case QCryptographicHash::Md5:
+        return QStringLiteral("md5");
+    case QCryptographicHash::Sha1:
+        return QStringLiteral("sha1");
+    default:
+        return QStringLiteral("sha256");
+    }
+}
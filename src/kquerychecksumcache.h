@@ -0,0 +1,58 @@
+/*******************************************************************
+* kquerychecksumcache.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYCHECKSUMCACHE_H
+#define KQUERYCHECKSUMCACHE_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QString>
+
+/* The checksums of files, kept so that searching the same files for a
+ * checksum again does not read them again.
+ *
+ * A checksum is only a few bytes, so unlike the other caches the entries
+ * are not files of their own: they are appended to a single log, which
+ * is read into memory once and rewritten by prune(). Entries are keyed
+ * like those of KQueryCacheDir. A checksum can also be kept in a
+ * user.kfind.<algorithm> extended attribute of the file itself, which
+ * then stays with the file when it is renamed. All functions can be
+ * called from any thread. */
+class KQueryChecksumCache
+{
+public:
+    /* Empty if the file cannot be stat'ed */
+    static QString key(const QString &path);
+
+    /* Looks at the extended attribute first if useXattr, false on a
+     * miss. Anyone who can write to a file can set its attribute, so it
+     * is only trusted when asked for. */
+    static bool load(const QString &path, const QString &key, QCryptographicHash::Algorithm algorithm,
+                     QByteArray *checksum, bool useXattr);
+    /* Also sets the extended attribute if useXattr, when possible */
+    static void store(const QString &path, const QString &key, QCryptographicHash::Algorithm algorithm,
+                      const QByteArray &checksum, bool useXattr);
+
+    /* Drops the oldest entries once the log is over the size limit */
+    static void prune();
+
+    /* Lower case, as in the extended attribute names */
+    static QString algorithmName(QCryptographicHash::Algorithm algorithm);
+};
+
+#endif
@@ -0,0 +1,1028 @@
+/*******************************************************************
+* kquerycontent.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kquerycontent.h"
+#include "kfind_debug.h"
+#include "kfindtrace.h"
+#include "kqueryarchive.h"
+#include "kquerybytesearch.h"
+#include "kquerychecksumcache.h"
+#include "kquerymetainfocache.h"
+#include "kquerystats.h"
+#include "kquerytextcache.h"
+#include "kqueryxmltextdevice.h"
+
+#include <QFile>
+#include <QHash>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QScopedPointer>
+#include <QSet>
+#include <QTextCodec>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <karchivefile.h>
+#include <kfilemetainfo.h>
+#include <kfilterdev.h>
+#include <kmimetype.h>
+#include <kzip.h>
+
+#include <algorithm>
+
+// Longer lines are cut, so a file without line breaks is not read at once
+static const qint64 maxLineLength = 1024 * 1024;
+// Read at once while looking for the end of a line, a cancel is noticed
+// between two pieces
+static const qint64 linePieceLength = 64 * 1024;
+
+// Decompressed bytes looked at to tell whether a compressed file is binary
+static const qint64 binaryCheckLength = 1024;
+
+// Matches stored per file and per search, any further ones are only counted
+static const int maxMatchesPerFile = 1000;
+static const int maxMatchesPerSearch = 100000;
+
+// Read at once when computing a checksum
+static const qint64 checksumChunkSize = 1024 * 1024;
+
+KQueryContentCriteria::KQueryContentCriteria()
+    : caseSensitive(false)
+    , searchBinary(false)
+    , useRegexp(false)
+    , searchCompressed(false)
+    , allMatches(false)
+    , contextLines(0)
+    , checksumAlgorithm(QCryptographicHash::Sha256)
+    , checksumXattr(false)
+{
+    // Files with these mime types can be ignored, even if
+    // findFormatByFileContent() in some cases may claim that
+    // these are text files:
+    ignoreMimetypes.append(QStringLiteral("application/pdf"));
+    ignoreMimetypes.append(QStringLiteral("application/postscript"));
+
+    // PLEASE update the documentation when you add another
+    // file type here:
+    oooMimetypes.append(QStringLiteral("application/vnd.sun.xml.writer"));
+    oooMimetypes.append(QStringLiteral("application/vnd.sun.xml.calc"));
+    oooMimetypes.append(QStringLiteral("application/vnd.sun.xml.impress"));
+    // OASIS mimetypes, used by OOo-2.x and KOffice >= 1.4
+    oooMimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.chart"));
+    oooMimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.graphics"));
+    oooMimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.graphics-template"));
+    oooMimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.formula"));
+    oooMimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.image"));
+    oooMimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.presentation-template"));
+    oooMimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.presentation"));
+    oooMimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.spreadsheet-template"));
+    oooMimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.spreadsheet"));
+    oooMimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.text-template"));
+    oooMimetypes.append(QStringLiteral("application/vnd.oasis.opendocument.text"));
+    // KOffice-1.3 mimetypes
+    kofficeMimetypes.append(QStringLiteral("application/x-kword"));
+    kofficeMimetypes.append(QStringLiteral("application/x-kspread"));
+    kofficeMimetypes.append(QStringLiteral("application/x-kpresenter"));
+    // Office Open XML, used by Microsoft Office >= 2007
+    ooxmlMimetypes.append(QStringLiteral("application/vnd.openxmlformats-officedocument.wordprocessingml.document"));
+    ooxmlMimetypes.append(QStringLiteral("application/vnd.openxmlformats-officedocument.wordprocessingml.template"));
+    ooxmlMimetypes.append(QStringLiteral("application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"));
+    ooxmlMimetypes.append(QStringLiteral("application/vnd.openxmlformats-officedocument.spreadsheetml.template"));
+    ooxmlMimetypes.append(QStringLiteral("application/vnd.openxmlformats-officedocument.presentationml.presentation"));
+    ooxmlMimetypes.append(QStringLiteral("application/vnd.openxmlformats-officedocument.presentationml.template"));
+    ooxmlMimetypes.append(QStringLiteral("application/vnd.openxmlformats-officedocument.presentationml.slideshow"));
+}
+
+namespace {
+
+/* What is searched in a file: the file itself or the text of the XML
+ * part of a zipped office document, inflated while it is read */
+struct ContentSource {
+    ContentSource()
+        : codec(nullptr)
+        , text(nullptr)
+        , compressedFile(nullptr)
+        , checkBinary(false)
+        , seekable(false)
+    {
+    }
+
+    /* Bytes taken from the disk so far, given the bytes of text read */
+    qint64 bytesRead(qint64 textBytes) const
+    {
+        if (text) {
+            return text->compressedBytesRead();
+        }
+        return compressedFile ? compressedFile->pos() : textBytes;
+    }
+
+    // Declared before device, which reads from them
+    KQueryOpenArchive::Ptr member;
+    QScopedPointer<QMutexLocker> memberLock;
+    QScopedPointer<KZip> archive;
+    QScopedPointer<QIODevice> device;
+    QTextCodec *codec;
+    // device, if the text is extracted from the archive
+    KQueryXmlTextDevice *text;
+    // What device decompresses, for a compressed file
+    QFile *compressedFile;
+    // Whether the content is text is only known once it is read
+    bool checkBinary;
+    // Lines can be read again at their offsets
+    bool seekable;
+};
+
+bool isCompressed(const QString &mimetype)
+{
+    return KFilterDev::compressionTypeForMimeType(mimetype) != KCompressionDevice::None;
+}
+
+bool isOfficeDocument(const KQueryContentCriteria &criteria, const QString &mimetype)
+{
+    return criteria.oooMimetypes.indexOf(mimetype) != -1
+           || criteria.kofficeMimetypes.indexOf(mimetype) != -1
+           || criteria.ooxmlMimetypes.indexOf(mimetype) != -1;
+}
+
+bool slideLessThan(const QString &a, const QString &b)
+{
+    // slide2.xml comes before slide10.xml
+    return a.midRef(5).toInt() < b.midRef(5).toInt();
+}
+
+/* The XML files holding the text of an office document, in reading order */
+QList<const KZipFileEntry *> documentParts(const KArchiveDirectory *root, const KQueryContentCriteria &criteria, const QString &mimetype)
+{
+    QStringList names;
+    if (criteria.kofficeMimetypes.indexOf(mimetype) != -1) {
+        names.append(QStringLiteral("maindoc.xml"));
+    } else if (criteria.ooxmlMimetypes.indexOf(mimetype) == -1) {
+        names.append(QStringLiteral("content.xml")); //for OpenOffice.org
+    } else if (mimetype.contains(QLatin1String("wordprocessingml"))) {
+        names.append(QStringLiteral("word/document.xml"));
+    } else if (mimetype.contains(QLatin1String("spreadsheetml"))) {
+        // The cells refer to these, numbers are not searched
+        names.append(QStringLiteral("xl/sharedStrings.xml"));
+    } else {
+        const KArchiveEntry *slides = root->entry(QStringLiteral("ppt/slides"));
+        if (slides && slides->isDirectory()) {
+            QStringList slideNames = static_cast<const KArchiveDirectory *>(slides)->entries()
+                                     .filter(QRegExp(QStringLiteral("^slide\\d+\\.xml$")));
+            std::sort(slideNames.begin(), slideNames.end(), slideLessThan);
+            for (const QString &name : qAsConst(slideNames)) {
+                names.append(QStringLiteral("ppt/slides/") + name);
+            }
+        }
+    }
+
+    QList<const KZipFileEntry *> parts;
+    for (const QString &name : qAsConst(names)) {
+        const KArchiveEntry *entry = root->entry(name);
+        if (entry && entry->isFile()) {
+            parts.append(static_cast<const KZipFileEntry *>(entry));
+        }
+    }
+    return parts;
+}
+
+bool openMember(const QString &archivePath, const QString &memberPath, ContentSource *source)
+{
+    // Opened once for the search by the listing of its members
+    source->member = KQueryArchiveLister::sharedArchive(archivePath);
+    const KArchive *archive = source->member->archive.data();
+    const KArchiveEntry *entry = archive ? archive->directory()->entry(memberPath) : nullptr;
+    if (!entry || !entry->isFile()) {
+        return false;
+    }
+
+    // Stored members are read in place, deflated ones inflated while read,
+    // one member of the archive at a time
+    source->memberLock.reset(new QMutexLocker(&source->member->mutex));
+    source->device.reset(static_cast<const KArchiveFile *>(entry)->createDevice());
+    source->codec = QTextCodec::codecForLocale();
+    source->checkBinary = true;
+    return source->device && (source->device->isOpen() || source->device->open(QIODevice::ReadOnly));
+}
+
+bool openDevice(const KFileItem &item, const QString &mimetype, const KQueryContentCriteria &criteria, ContentSource *source)
+{
+    // Members of archives are searched as they are, even office documents
+    QString archivePath;
+    QString memberPath;
+    if (KQueryArchiveLister::splitMemberUrl(item.url(), &archivePath, &memberPath)) {
+        return openMember(archivePath, memberPath, source);
+    }
+
+    // FIXME: doesn't work with non local files
+    const QString filename = item.url().path();
+
+    // KWord's, OpenOffice.org's and Microsoft Office's files are zipped...
+    if (isOfficeDocument(criteria, mimetype)) {
+        // Text extracted from the same, unchanged document before
+        const QString cacheKey = KQueryTextCache::key(filename);
+        if (QIODevice *cached = KQueryTextCache::open(cacheKey)) {
+            KQueryStats::add(KQueryStats::TextCacheHits);
+            source->device.reset(cached);
+            source->codec = QTextCodec::codecForName("UTF-8");
+            source->seekable = true;
+            return true;
+        }
+
+        QScopedPointer<KZip> zipfile(new KZip(filename));
+
+        if (zipfile->open(QIODevice::ReadOnly)) {
+            const QList<const KZipFileEntry *> parts = documentParts(zipfile->directory(), criteria, mimetype);
+            if (parts.isEmpty()) {
+                qCWarning(KFING_LOG) << "Expected XML file not found in ZIP archive " << item.url();
+                return false;
+            }
+
+            // Inflated piece by piece instead of at once with data()
+            source->text = new KQueryXmlTextDevice(zipfile.data(), parts);
+            source->text->setCopy(KQueryTextCache::create(cacheKey), KQueryTextCache::maxEntrySize());
+            source->text->open(QIODevice::ReadOnly);
+            source->archive.reset(zipfile.take());
+            source->device.reset(source->text);
+            source->codec = QTextCodec::codecForName("UTF-8");
+            return true;
+        }
+        qCWarning(KFING_LOG) << "Cannot open supposed ZIP file " << item.url();
+    }
+
+    //any other file or non-compressed KWord
+    if (filename.startsWith(QLatin1String("/dev/"))) {
+        return false;
+    }
+    QFile *file = new QFile(filename);
+    source->codec = QTextCodec::codecForLocale();
+
+    // gzip, bzip2, xz and (if KArchive supports it) zstd files are
+    // decompressed while they are read
+    if (criteria.searchCompressed) {
+        const KCompressionDevice::CompressionType type = KFilterDev::compressionTypeForMimeType(mimetype);
+        if (type != KCompressionDevice::None) {
+            source->compressedFile = file;
+            source->checkBinary = true;
+            source->device.reset(new KCompressionDevice(file, true, type));
+            return file->open(QIODevice::ReadOnly) && source->device->open(QIODevice::ReadOnly);
+        }
+    }
+
+    source->device.reset(file);
+    source->seekable = true;
+    return file->open(QIODevice::ReadOnly);
+}
+
+bool isUtf16(const QTextCodec *codec)
+{
+    return codec->mibEnum() == 1013 || codec->mibEnum() == 1014;
+}
+
+/* Text files starting with a byte order mark are read in its encoding
+ * instead of the one of the locale */
+void detectByteOrderMark(ContentSource *source)
+{
+    const QByteArray start = source->device->peek(3);
+    if (start.startsWith("\xef\xbb\xbf")) {
+        source->codec = QTextCodec::codecForMib(106);
+    } else if (start.startsWith("\xff\xfe")) {
+        source->codec = QTextCodec::codecForMib(1014);
+    } else if (start.startsWith("\xfe\xff")) {
+        source->codec = QTextCodec::codecForMib(1013);
+    }
+    // Every other byte of UTF-16 text is NUL
+    if (isUtf16(source->codec)) {
+        source->checkBinary = false;
+    }
+}
+
+bool openContent(const KFileItem &item, const QString &mimetype, const KQueryContentCriteria &criteria, ContentSource *source)
+{
+    if (!openDevice(item, mimetype, criteria, source)) {
+        return false;
+    }
+    detectByteOrderMark(source);
+    return true;
+}
+
+/* Whether a line can be decoded without the lines before it, so lines
+ * that are not shown need not be decoded at all. True for UTF-8, UTF-16
+ * and the single byte encodings, whose lines end with whole characters. */
+bool decodesByLine(const QTextCodec *codec)
+{
+    const int mib = codec->mibEnum();
+    return mib == 106 || mib == 1013 || mib == 1014 || mib == 3 // UTF-8, UTF-16, US-ASCII
+           || (mib >= 4 && mib <= 13) || (mib >= 109 && mib <= 112) // ISO 8859
+           || (mib >= 2250 && mib <= 2258); // Windows code pages
+}
+
+/* Finds the text searched for in the undecoded bytes of a line.
+ *
+ * The text is encoded once into the encoding of the file. Regular
+ * expressions, encodings without decodesByLine() and case insensitive
+ * searches for anything but ASCII text are not handled, isValid() is
+ * false then and the lines have to be decoded. */
+class ByteMatcher
+{
+public:
+    enum Result {
+        NoMatch,
+        Match,
+        // Only the decoded line tells
+        Undecided
+    };
+
+    ByteMatcher(const KQueryContentCriteria &criteria, const QTextCodec *codec)
+        : m_valid(false)
+        , m_never(false)
+        , m_utf16(isUtf16(codec))
+        , m_foldsFromNonAscii(false)
+    {
+        const bool caseInsensitive = !criteria.caseSensitive;
+        if (criteria.useRegexp || criteria.context.isEmpty() || !decodesByLine(codec)) {
+            return;
+        }
+
+        const QString &text = criteria.context;
+        if (caseInsensitive) {
+            // ASCII letters are folded byte by byte, that fails for UTF-16
+            if (m_utf16) {
+                return;
+            }
+            for (const QChar c : text) {
+                if (c.unicode() >= 0x80) {
+                    return;
+                }
+            }
+            // U+017F and U+212A fold to s and k, both are encoded in UTF-8
+            // only, with bytes over 0x7f
+            m_foldsFromNonAscii = codec->mibEnum() == 106
+                                  && (text.contains(QLatin1Char('s'), Qt::CaseInsensitive)
+                                      || text.contains(QLatin1Char('k'), Qt::CaseInsensitive));
+        }
+
+        QTextCodec::ConverterState state(QTextCodec::IgnoreHeader);
+        const QByteArray pattern = codec->fromUnicode(text.constData(), text.size(), &state);
+        // Text the encoding cannot hold does not occur in the file either
+        m_never = state.invalidChars > 0;
+        m_search.setPattern(pattern, caseInsensitive);
+        m_valid = true;
+    }
+
+    bool isValid() const
+    {
+        return m_valid;
+    }
+
+    Result matches(const char *data, int length) const
+    {
+        if (m_never) {
+            return NoMatch;
+        }
+
+        int from = 0;
+        while (true) {
+            const int index = m_search.indexIn(data, length, from);
+            // Lines of UTF-16 text start on a character, matches have to as well
+            if (index >= 0 && (!m_utf16 || index % 2 == 0)) {
+                return Match;
+            }
+            if (index < 0) {
+                break;
+            }
+            from = index + 1;
+        }
+
+        if (m_foldsFromNonAscii && !KQueryByteSearch::isAscii(data, length)) {
+            return Undecided;
+        }
+        return NoMatch;
+    }
+
+private:
+    bool m_valid;
+    bool m_never;
+    bool m_utf16;
+    bool m_foldsFromNonAscii;
+    KQueryByteSearch m_search;
+};
+
+/* Splits the source into lines and remembers where each one starts.
+ * Lines are only decoded when their text is asked for, if the encoding
+ * allows it. */
+class LineReader
+{
+public:
+    /* scanner is nullptr outside of a scan */
+    explicit LineReader(ContentSource *source, const KQueryContentScanner *scanner = nullptr, int generation = 0)
+        : m_source(source)
+        , m_scanner(scanner)
+        , m_generation(generation)
+        , m_decoder(source->codec->makeDecoder())
+        , m_decodeAll(!decodesByLine(source->codec))
+        , m_utf16(isUtf16(source->codec))
+        , m_bigEndian(source->codec->mibEnum() == 1013)
+        , m_data(nullptr)
+        , m_length(0)
+        , m_decoded(false)
+        , m_offset(0)
+        , m_lineOffset(0)
+        , m_line(0)
+    {
+    }
+
+    bool next()
+    {
+        // One buffer per thread, sized for the longest piece once
+        static thread_local QByteArray buffer;
+        if (buffer.size() <= maxLineLength) {
+            buffer.resize(maxLineLength + 1);
+        }
+
+        char *const data = buffer.data();
+        QIODevice *const device = m_source->device.data();
+        qint64 length = 0;
+        do {
+            if (isCanceled()) {
+                return false;
+            }
+            const qint64 piece = device->readLine(data + length, qMin(linePieceLength, maxLineLength - length) + 1);
+            if (piece <= 0) {
+                break;
+            }
+            length += piece;
+        } while (length < maxLineLength && data[length - 1] != '\n');
+        if (length <= 0) {
+            return false;
+        }
+
+        // readLine() stops at every '\n' byte, UTF-16 lines end at a '\n'
+        // character only
+        while (m_utf16 && length < maxLineLength && data[length - 1] == '\n') {
+            if (isCanceled()) {
+                return false;
+            }
+            if (length % 2 != 0) {
+                if (!device->getChar(data + length)) {
+                    break;
+                }
+                length++;
+            }
+            const char *unit = data + length - 2;
+            if (m_bigEndian ? (unit[0] == '\0' && unit[1] == '\n') : (unit[0] == '\n' && unit[1] == '\0')) {
+                break;
+            }
+            const qint64 more = device->readLine(data + length, qMin(linePieceLength, maxLineLength - length) + 1);
+            if (more <= 0) {
+                break;
+            }
+            length += more;
+        }
+
+        m_data = data;
+        m_length = int(length);
+        m_decoded = false;
+        m_lineOffset = m_offset;
+        m_offset += length;
+        m_line++;
+
+        if (m_decodeAll) {
+            text();
+        }
+        return true;
+    }
+
+    /* Continues at a line whose number and offset are known */
+    bool seek(int line, qint64 offset)
+    {
+        if (!m_source->device->seek(offset)) {
+            return false;
+        }
+        m_decoder.reset(m_source->codec->makeDecoder());
+        m_offset = offset;
+        m_line = line - 1;
+        return true;
+    }
+
+    /* The undecoded line, valid until next() */
+    const char *data() const
+    {
+        return m_data;
+    }
+
+    int length() const
+    {
+        return m_length;
+    }
+
+    const QString &text()
+    {
+        if (!m_decoded) {
+            m_decoded = true;
+            m_text = m_decoder->toUnicode(m_data, m_length);
+            while (m_text.endsWith(QLatin1Char('\n')) || m_text.endsWith(QLatin1Char('\r'))) {
+                m_text.chop(1);
+            }
+        }
+        return m_text;
+    }
+
+    int line() const
+    {
+        return m_line;
+    }
+
+    qint64 offset() const
+    {
+        return m_lineOffset;
+    }
+
+    qint64 bytesRead() const
+    {
+        return m_offset;
+    }
+
+private:
+    bool isCanceled() const
+    {
+        return m_scanner && m_scanner->isCanceled(m_generation);
+    }
+
+    ContentSource *m_source;
+    const KQueryContentScanner *m_scanner;
+    int m_generation;
+    QScopedPointer<QTextDecoder> m_decoder;
+    // The decoder needs every line to decode the next one right
+    bool m_decodeAll;
+    bool m_utf16;
+    bool m_bigEndian;
+    const char *m_data;
+    int m_length;
+    bool m_decoded;
+    QString m_text;
+    qint64 m_offset;
+    qint64 m_lineOffset;
+    int m_line;
+};
+
+/* Whether metainfo key matches the keys searched. Files of a type have
+ * the same keys, so the answers are remembered, per thread as QRegExp
+ * must not be shared. */
+bool isSearchedKey(const QRegExp &keyRegexp, const QString &key)
+{
+    static thread_local QString pattern;
+    static thread_local QHash<QString, bool> keys;
+    if (keyRegexp.pattern() != pattern) {
+        pattern = keyRegexp.pattern();
+        keys.clear();
+    }
+
+    QHash<QString, bool>::iterator it = keys.find(key);
+    if (it == keys.end()) {
+        QRegExp regexp = keyRegexp;
+        it = keys.insert(key, regexp.exactMatch(key));
+    }
+    return *it;
+}
+
+QString formatLine(int line, const QString &text, bool matched)
+{
+    return QString::number(line) + (matched ? QStringLiteral(": ") : QStringLiteral("- ")) + text;
+}
+
+/* Reads the file in large chunks, giving up at a cancel between two of
+ * them. scanner is nullptr outside of a scan. */
+bool hashFile(const QString &path, QCryptographicHash::Algorithm algorithm, QByteArray *checksum,
+              const KQueryContentScanner *scanner, int generation)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        qCDebug(KFING_LOG) << "Cannot compute the checksum of" << path << file.errorString();
+        return false;
+    }
+
+    KFindTrace::Scope trace("checksumFile");
+    QCryptographicHash hash(algorithm);
+    QByteArray buffer(int(checksumChunkSize), Qt::Uninitialized);
+    for (;;) {
+        if (scanner && scanner->isCanceled(generation)) {
+            return false;
+        }
+        const qint64 count = file.read(buffer.data(), buffer.size());
+        if (count < 0) {
+            return false;
+        }
+        if (count == 0) {
+            break;
+        }
+        KQueryStats::add(KQueryStats::BytesRead, count);
+        hash.addData(buffer.constData(), int(count));
+    }
+    KQueryStats::add(KQueryStats::FilesHashed);
+    *checksum = hash.result();
+    return true;
+}
+
+}
+
+class KQueryContentTask : public QRunnable
+{
+public:
+    KQueryContentTask(KQueryContentScanner *scanner, int generation,
+                      const QSharedPointer<const KQueryContentCriteria> &criteria, const KFileItem &item)
+        : m_scanner(scanner)
+        , m_generation(generation)
+        , m_criteria(criteria)
+        , m_item(item)
+        , m_search(KQueryStats::currentSearch())
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        if (m_scanner->isCanceled(m_generation)) {
+            return;
+        }
+
+        KQueryStats::SearchScope stats(m_search);
+
+        KQueryResult result(m_item);
+        bool found = true;
+        if (!m_criteria->checksum.isEmpty() && !matchChecksum()) {
+            KQueryStats::add(KQueryStats::RejectedChecksum);
+            found = false;
+        } else if (!m_criteria->metainfo.isEmpty() && !m_criteria->metainfoKey.isEmpty() && !matchMetaInfo()) {
+            KQueryStats::add(KQueryStats::RejectedMetaInfo);
+            found = false;
+        } else if (!m_criteria->context.isEmpty() && !matchContent(&result)) {
+            KQueryStats::add(KQueryStats::RejectedContent);
+            found = false;
+        }
+        m_scanner->scanned(m_generation, result, found);
+    }
+
+private:
+    bool isCanceled() const
+    {
+        return m_scanner->isCanceled(m_generation);
+    }
+
+    bool matchChecksum();
+    bool matchMetaInfo();
+    bool matchContent(KQueryResult *result);
+
+    KQueryContentScanner *m_scanner;
+    int m_generation;
+    QSharedPointer<const KQueryContentCriteria> m_criteria;
+    KFileItem m_item;
+    int m_search;
+};
+
+bool KQueryContentTask::matchChecksum()
+{
+    if (!m_item.isRegularFile() || !m_item.url().isLocalFile()) {
+        return false;
+    }
+
+    const QString path = m_item.url().toLocalFile();
+    KQueryStats::StageTimer timer(KQueryStats::ChecksumStage);
+
+    // Reading the whole file is the slowest check there is, so what was
+    // computed is kept
+    const QString cacheKey = KQueryChecksumCache::key(path);
+    QByteArray checksum;
+    if (KQueryChecksumCache::load(path, cacheKey, m_criteria->checksumAlgorithm, &checksum, m_criteria->checksumXattr)) {
+        KQueryStats::add(KQueryStats::ChecksumCacheHits);
+    } else {
+        if (!hashFile(path, m_criteria->checksumAlgorithm, &checksum, m_scanner, m_generation)) {
+            return false;
+        }
+        KQueryChecksumCache::store(path, cacheKey, m_criteria->checksumAlgorithm, checksum, m_criteria->checksumXattr);
+    }
+    return checksum == m_criteria->checksum;
+}
+
+bool KQueryContentTask::matchMetaInfo()
+{
+    //Avoid sequential files (fifo,char devices)
+    if (!m_item.isRegularFile()) {
+        return false;
+    }
+
+    QString filename = m_item.url().path();
+
+    if (filename.startsWith(QLatin1String("/dev/"))) {
+        return false;
+    }
+
+    KQueryStats::StageTimer timer(KQueryStats::MetaInfoStage);
+
+    // Extracting is slow for media files, so what was extracted is kept
+    const QString cacheKey = KQueryMetaInfoCache::key(filename);
+    QHash<QString, QString> values;
+    if (KQueryMetaInfoCache::load(cacheKey, &values)) {
+        KQueryStats::add(KQueryStats::MetaInfoCacheHits);
+    } else {
+        // The extraction itself cannot be interrupted
+        if (isCanceled()) {
+            return false;
+        }
+        KFileMetaInfo metadatas(filename);
+        const QStringList metakeys = metadatas.supportedKeys();
+        for (const QString &metakey : metakeys) {
+            if (isCanceled()) {
+                return false;
+            }
+            values.insert(metakey, metadatas.item(metakey).value().toString());
+        }
+        KQueryMetaInfoCache::store(cacheKey, values);
+    }
+
+    for (QHash<QString, QString>::const_iterator it = values.constBegin(); it != values.constEnd(); ++it) {
+        if (isSearchedKey(m_criteria->metainfoKeyRegexp, it.key())
+            && it.value().indexOf(m_criteria->metainfo) != -1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool KQueryContentTask::matchContent(KQueryResult *result)
+{
+    const KQueryContentCriteria &criteria = *m_criteria;
+
+    //Avoid sequential files (fifo,char devices)
+    if (!m_item.isRegularFile()) {
+        return false;
+    }
+
+    QString mimetype;
+    {
+        KQueryStats::StageTimer timer(KQueryStats::MimeTypeStage);
+        mimetype = m_item.mimetype();
+    }
+
+    if (!criteria.searchBinary && criteria.ignoreMimetypes.indexOf(mimetype) != -1) {
+        return false;
+    }
+
+    // Compressed files are checked once decompressed
+    const bool compressed = criteria.searchCompressed && isCompressed(mimetype);
+
+    if (!isOfficeDocument(criteria, mimetype) && !compressed && !criteria.searchBinary && !mimetype.startsWith(QLatin1String("text/"))
+        && m_item.url().isLocalFile() && !m_item.url().path().startsWith(QLatin1String("/dev"))) {
+        if (KMimeType::isBinaryData(m_item.url().path())) {
+            return false;
+        }
+    }
+
+    if (isCanceled()) {
+        return false;
+    }
+
+    KQueryStats::StageTimer contentTimer(KQueryStats::ContentStage);
+    KFindTrace::Scope trace("contentScan");
+
+    ContentSource source;
+    if (!openContent(m_item, mimetype, criteria, &source)) {
+        return false;
+    }
+
+    if (source.checkBinary && !criteria.searchBinary
+        && source.device->peek(binaryCheckLength).contains('\0')) {
+        KQueryStats::add(KQueryStats::BytesRead, source.bytesRead(0));
+        return false;
+    }
+
+    KQueryStats::add(KQueryStats::FilesContentScanned);
+
+    // Shared QRegExp objects must not be used from several threads
+    QRegExp regexp = criteria.regexp;
+    const Qt::CaseSensitivity caseSensitivity = criteria.caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive;
+
+    QScopedPointer<KQueryMatches> matches;
+    if (criteria.allMatches) {
+        matches.reset(new KQueryMatches);
+        matches->contextLines = criteria.contextLines;
+        matches->decompressed = source.compressedFile != nullptr;
+    }
+
+    bool found = false;
+    LineReader reader(&source, m_scanner, m_generation);
+    // Lines are only decoded to show them, if the text can be found in bytes
+    const ByteMatcher byteMatcher(criteria, source.codec);
+    while (!isCanceled() && reader.next()) {
+        const ByteMatcher::Result byteResult = byteMatcher.isValid() ? byteMatcher.matches(reader.data(), reader.length())
+                                                                     : ByteMatcher::Undecided;
+        bool matched = byteResult == ByteMatcher::Match;
+        if (byteResult == ByteMatcher::Undecided) {
+            const QString &str = reader.text();
+            matched = criteria.useRegexp ? regexp.indexIn(str) >= 0
+                                         : str.indexOf(criteria.context, 0, caseSensitivity) != -1;
+        }
+        if (!matched) {
+            continue;
+        }
+
+        if (!found) {
+            result->matchingLine = formatLine(reader.line(), reader.text().trimmed(), true);
+            found = true;
+        }
+        if (!matches) {
+            break;
+        }
+
+        matches->count++;
+        if (matches->matches.size() < maxMatchesPerFile && m_scanner->reserveMatch()) {
+            KQueryMatch match;
+            match.line = reader.line();
+            match.offset = reader.offset();
+            matches->matches.append(match);
+        }
+    }
+
+    // A document that matched is searched again most likely, the rest of
+    // its text is extracted too so that it is cached
+    if (source.text) {
+        while (!isCanceled() && source.text->copyMore()) {
+        }
+    }
+
+    KQueryStats::add(KQueryStats::BytesRead, source.bytesRead(reader.bytesRead()));
+
+    if (found && matches) {
+        result->matches = QSharedPointer<const KQueryMatches>(matches.take());
+    }
+    return found;
+}
+
+bool KQueryContentScanner::checksum(const QString &path, QCryptographicHash::Algorithm algorithm, QByteArray *checksum)
+{
+    return hashFile(path, algorithm, checksum, nullptr, 0);
+}
+
+QStringList KQueryContentScanner::matchText(const KFileItem &item, const KQueryMatches &matches)
+{
+    QStringList texts;
+    if (matches.matches.isEmpty()) {
+        return texts;
+    }
+
+    KQueryContentCriteria criteria;
+    criteria.searchCompressed = matches.decompressed;
+    ContentSource source;
+    if (!openContent(item, item.mimetype(), criteria, &source)) {
+        return texts;
+    }
+
+    LineReader reader(&source);
+    const int context = matches.contextLines;
+
+    // Without context the lines of a plain file are read at their offsets
+    if (context == 0 && source.seekable) {
+        for (const KQueryMatch &match : matches.matches) {
+            if (reader.seek(match.line, match.offset) && reader.next()) {
+                texts.append(formatLine(match.line, reader.text(), true));
+            } else {
+                texts.append(QString());
+            }
+        }
+        return texts;
+    }
+
+    QSet<int> wanted;
+    for (const KQueryMatch &match : matches.matches) {
+        for (int line = match.line - context; line <= match.line + context; line++) {
+            wanted.insert(line);
+        }
+    }
+
+    const int last = matches.matches.last().line + context;
+    QHash<int, QString> lines;
+    while (reader.next() && reader.line() <= last) {
+        if (wanted.contains(reader.line())) {
+            lines.insert(reader.line(), reader.text());
+        }
+    }
+
+    for (const KQueryMatch &match : matches.matches) {
+        QStringList block;
+        for (int line = match.line - context; line <= match.line + context; line++) {
+            const QHash<int, QString>::const_iterator it = lines.constFind(line);
+            if (it != lines.constEnd()) {
+                block.append(formatLine(line, *it, line == match.line));
+            }
+        }
+        texts.append(block.join(QLatin1Char('\n')));
+    }
+    return texts;
+}
+
+KQueryContentScanner::KQueryContentScanner(QObject *parent)
+    : QObject(parent)
+    , m_criteria(new KQueryContentCriteria)
+    , m_pending(0)
+    , m_finished(0)
+{
+}
+
+KQueryContentScanner::~KQueryContentScanner()
+{
+    // The scans point to this object, they stop at their next check
+    cancel();
+    m_pool.waitForDone();
+}
+
+void KQueryContentScanner::setCriteria(const KQueryContentCriteria &criteria)
+{
+    m_criteria.reset(new KQueryContentCriteria(criteria));
+    m_storedMatches.store(0);
+
+    if (!criteria.context.isEmpty()) {
+        QtConcurrent::run(&KQueryTextCache::prune);
+    }
+    if (!criteria.metainfo.isEmpty()) {
+        QtConcurrent::run(&KQueryMetaInfoCache::prune);
+    }
+    if (!criteria.checksum.isEmpty()) {
+        QtConcurrent::run(&KQueryChecksumCache::prune);
+    }
+}
+
+void KQueryContentScanner::scan(const KFileItem &item)
+{
+    m_pending++;
+    m_pool.start(new KQueryContentTask(this, m_generation.load(), m_criteria, item));
+}
+
+void KQueryContentScanner::cancel()
+{
+    m_generation.ref();
+    m_pool.clear();
+
+    QMutexLocker locker(&m_mutex);
+    m_found.clear();
+    m_finished = 0;
+    m_pending = 0;
+}
+
+int KQueryContentScanner::pendingCount() const
+{
+    return m_pending;
+}
+
+bool KQueryContentScanner::reserveMatch()
+{
+    return m_storedMatches.fetchAndAddRelaxed(1) < maxMatchesPerSearch;
+}
+
+void KQueryContentScanner::scanned(int generation, const KQueryResult &result, bool found)
+{
+    QMutexLocker locker(&m_mutex);
+    if (isCanceled(generation)) {
+        return;
+    }
+
+    // One queued call delivers everything finished until it runs
+    if (m_finished == 0) {
+        QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
+    }
+    m_finished++;
+    if (found) {
+        m_found.append(result);
+    }
+}
+
+void KQueryContentScanner::deliver()
+{
+    QList<KQueryResult> items;
+    int finished;
+    {
+        QMutexLocker locker(&m_mutex);
+        items.swap(m_found);
+        finished = m_finished;
+        m_finished = 0;
+    }
+
+    m_pending -= finished;
+    if (!items.isEmpty()) {
+        emit found(items);
+    }
+    if (m_pending == 0 && finished > 0) {
+        emit idle();
+    }
+}
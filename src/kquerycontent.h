@@ -0,0 +1,186 @@
+/*******************************************************************
+* kquerycontent.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYCONTENT_H
+#define KQUERYCONTENT_H
+
+#include <QAtomicInt>
+#include <QCryptographicHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QRegExp>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include <kfileitem.h>
+
+/* A matching line, the text is read again when it is shown */
+struct KQueryMatch {
+    /* Starting at 1 */
+    int line;
+    /* Of the line start, in bytes of the searched text */
+    qint64 offset;
+};
+Q_DECLARE_TYPEINFO(KQueryMatch, Q_PRIMITIVE_TYPE);
+
+/* All matching lines of a file */
+struct KQueryMatches {
+    KQueryMatches()
+        : count(0)
+        , contextLines(0)
+        , decompressed(false)
+    {
+    }
+
+    /* Can be fewer than count, the number stored is capped */
+    QVector<KQueryMatch> matches;
+    int count;
+    /* Lines shown before and after each match */
+    int contextLines;
+    /* The offsets are in the decompressed text of a compressed file */
+    bool decompressed;
+};
+
+struct KQueryDuplicateGroup;
+
+/* A file found by KQuery */
+struct KQueryResult {
+    KQueryResult()
+    {
+    }
+
+    KQueryResult(const KFileItem &item, const QString &matchingLine = QString())
+        : item(item)
+        , matchingLine(matchingLine)
+    {
+    }
+
+    KFileItem item;
+    /* "line: text" of the first match, if the content was searched */
+    QString matchingLine;
+    /* Only set when all matches are collected */
+    QSharedPointer<const KQueryMatches> matches;
+    /* Other paths to the same file that were left out, only set when
+     * hard links are collapsed. Grows while the search runs, it is read
+     * and written on the main thread only. */
+    QSharedPointer<int> otherLinks;
+    /* The copies of the file, only set when searching for duplicates */
+    QSharedPointer<const KQueryDuplicateGroup> duplicates;
+};
+
+/* The checks of a query that have to read the files */
+struct KQueryContentCriteria {
+    KQueryContentCriteria();
+
+    bool isEmpty() const
+    {
+        return context.isEmpty() && (metainfo.isEmpty() || metainfoKey.isEmpty()) && checksum.isEmpty();
+    }
+
+    QString context;
+    bool caseSensitive;
+    bool searchBinary;
+    bool useRegexp;
+    QRegExp regexp;
+    QString metainfo;
+    QString metainfoKey;
+    /* metainfoKey, a wildcard pattern */
+    QRegExp metainfoKeyRegexp;
+    /* Search the decompressed text of gzip, bzip2, xz and zstd files */
+    bool searchCompressed;
+    /* Collect every matching line instead of stopping at the first */
+    bool allMatches;
+    int contextLines;
+    /* Files must have this checksum, raw bytes, local files only */
+    QByteArray checksum;
+    QCryptographicHash::Algorithm checksumAlgorithm;
+    /* Also keep checksums in extended attributes of the files */
+    bool checksumXattr;
+
+    QStringList ignoreMimetypes;
+    QStringList oooMimetypes;   // OpenOffice.org mimetypes
+    QStringList kofficeMimetypes;
+    QStringList ooxmlMimetypes; // Office Open XML mimetypes
+};
+
+/* Runs the checksum, content and metainfo checks on a thread pool.
+ *
+ * Every scan carries the generation it was started in. cancel() moves to
+ * the next generation, so running scans give up at their next check (after
+ * 64 KiB read at most) and whatever they report afterwards is dropped. */
+class KQueryContentScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KQueryContentScanner(QObject *parent = nullptr);
+    ~KQueryContentScanner();
+
+    /* Used by the scans started from now on */
+    void setCriteria(const KQueryContentCriteria &criteria);
+
+    void scan(const KFileItem &item);
+    /* Drops queued scans and stops running ones */
+    void cancel();
+    /* Scans started and not yet reported */
+    int pendingCount() const;
+
+    bool isCanceled(int generation) const
+    {
+        return m_generation.load() != generation;
+    }
+
+    /* Reads the lines of the matches with their context, one text per
+     * match. Runs in the calling thread. */
+    static QStringList matchText(const KFileItem &item, const KQueryMatches &matches);
+    /* The checksum of a local file, as the scans compute it. Runs in the
+     * calling thread. */
+    static bool checksum(const QString &path, QCryptographicHash::Algorithm algorithm, QByteArray *checksum);
+
+Q_SIGNALS:
+    /* Files that passed */
+    void found(const QList<KQueryResult> &);
+    /* Every scan started has been reported */
+    void idle();
+
+private Q_SLOTS:
+    void deliver();
+
+private:
+    friend class KQueryContentTask;
+    /* Called from the pool threads */
+    void scanned(int generation, const KQueryResult &result, bool found);
+    /* Whether one more match may be stored, all files share a limit */
+    bool reserveMatch();
+
+    QThreadPool m_pool;
+    QAtomicInt m_generation;
+    QSharedPointer<const KQueryContentCriteria> m_criteria;
+    int m_pending;
+    QAtomicInt m_storedMatches;
+
+    // Filled by the pool threads, emptied by deliver()
+    QMutex m_mutex;
+    QList<KQueryResult> m_found;
+    int m_finished;
+};
+
+#endif
@@ -0,0 +1,406 @@
+/*******************************************************************
+* kqueryduplicates.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kqueryduplicates.h"
+#include "kfind_debug.h"
+#include "kfindtrace.h"
+#include "kquerystats.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QRunnable>
+
+#include <KUser>
+
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#else
+#include <QtEndian>
+#endif
+
+// Read from both ends of a file to tell files of the same size apart
+static const qint64 edgeSize = 64 * 1024;
+static const qint64 chunkSize = 256 * 1024;
+
+/* A 64 bit hash over data added in parts, to tell files apart quickly.
+ * XXH3 when available, otherwise the first 64 bits of MD5, which is
+ * slower but always there. */
+class KQueryHasher
+{
+public:
+#ifdef HAVE_XXHASH
+    KQueryHasher()
+        : m_state(XXH3_createState())
+    {
+        XXH3_64bits_reset(m_state);
+    }
+
+    ~KQueryHasher()
+    {
+        XXH3_freeState(m_state);
+    }
+
+    void add(const char *data, qint64 length)
+    {
+        XXH3_64bits_update(m_state, data, size_t(length));
+    }
+
+    quint64 result() const
+    {
+        return XXH3_64bits_digest(m_state);
+    }
+
+private:
+    XXH3_state_t *m_state;
+#else
+    KQueryHasher()
+        : m_hash(QCryptographicHash::Md5)
+    {
+    }
+
+    void add(const char *data, qint64 length)
+    {
+        m_hash.addData(data, int(length));
+    }
+
+    quint64 result() const
+    {
+        return qFromLittleEndian<quint64>(reinterpret_cast<const uchar *>(m_hash.result().constData()));
+    }
+
+private:
+    QCryptographicHash m_hash;
+#endif
+
+    Q_DISABLE_COPY(KQueryHasher)
+};
+
+class KQueryHashTask : public QRunnable
+{
+public:
+    KQueryHashTask(KQueryDuplicateFinder *finder, int generation, const QByteArray &path, KIO::filesize_t size, bool complete)
+        : m_finder(finder)
+        , m_generation(generation)
+        , m_path(path)
+        , m_size(size)
+        , m_complete(complete)
+        , m_search(KQueryStats::currentSearch())
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        if (m_finder->isCanceled(m_generation)) {
+            return;
+        }
+
+        KQueryStats::SearchScope stats(m_search);
+
+        KFindTrace::Scope trace(m_complete ? "hashFile" : "hashFileEnds");
+        KQueryDuplicateFinder::Hashed result;
+        result.path = m_path;
+        result.size = m_size;
+        result.hash = 0;
+        // The ends of a small file are all of it
+        result.complete = m_complete || m_size <= KIO::filesize_t(2 * edgeSize);
+        const bool ok = hashFile(&result);
+        KQueryStats::add(KQueryStats::FilesHashed);
+        m_finder->hashed(m_generation, result, ok);
+    }
+
+private:
+    bool hashFile(KQueryDuplicateFinder::Hashed *result)
+    {
+        QFile file(QFile::decodeName(m_path));
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+            qCDebug(KFING_LOG) << "Cannot hash" << file.fileName() << file.errorString();
+            return false;
+        }
+        // Changed since it was listed, the sizes compared are stale
+        if (KIO::filesize_t(file.size()) != m_size) {
+            return false;
+        }
+
+        if (result->complete) {
+            QCryptographicHash digest(QCryptographicHash::Sha256);
+            if (!read(&file, m_size, nullptr, &digest)) {
+                return false;
+            }
+            result->digest = digest.result();
+            return true;
+        }
+
+        KQueryHasher hasher;
+        if (!read(&file, edgeSize, &hasher, nullptr) || !file.seek(m_size - edgeSize)
+            || !read(&file, edgeSize, &hasher, nullptr)) {
+            return false;
+        }
+        result->hash = hasher.result();
+        return true;
+    }
+
+    /* Into either hasher or digest */
+    bool read(QFile *file, qint64 length, KQueryHasher *hasher, QCryptographicHash *digest)
+    {
+        if (m_buffer.isEmpty()) {
+            m_buffer.resize(int(chunkSize));
+        }
+        while (length > 0) {
+            if (m_finder->isCanceled(m_generation)) {
+                return false;
+            }
+            const qint64 count = file->read(m_buffer.data(), qMin<qint64>(length, m_buffer.size()));
+            if (count <= 0) {
+                return false;
+            }
+            KQueryStats::add(KQueryStats::BytesRead, count);
+            if (hasher) {
+                hasher->add(m_buffer.constData(), count);
+            } else {
+                digest->addData(m_buffer.constData(), int(count));
+            }
+            length -= count;
+        }
+        return true;
+    }
+
+    KQueryDuplicateFinder *m_finder;
+    int m_generation;
+    QByteArray m_path;
+    KIO::filesize_t m_size;
+    bool m_complete;
+    int m_search;
+    QByteArray m_buffer;
+};
+
+KQueryDuplicateFinder::KQueryDuplicateFinder(QObject *parent)
+    : QObject(parent)
+    , m_pending(0)
+    , m_finished(0)
+{
+}
+
+KQueryDuplicateFinder::~KQueryDuplicateFinder()
+{
+    // The tasks point to this object, they stop at their next check
+    cancel();
+    m_pool.waitForDone();
+}
+
+void KQueryDuplicateFinder::add(const QString &path, KIO::filesize_t size, const KIO::UDSEntry &entry)
+{
+    const QByteArray encoded = QFile::encodeName(path);
+    const QHash<KIO::filesize_t, int>::iterator first = m_sizes.find(size);
+    if (first == m_sizes.end()) {
+        m_sizes.insert(size, m_firstPaths.size());
+        m_firstPaths.append(encoded).append('\0');
+        return;
+    }
+
+    KIO::UDSEntry fileEntry = entry;
+    FileId id(entry.numberValue(KIO::UDSEntry::UDS_DEVICE_ID, 0), entry.numberValue(KIO::UDSEntry::UDS_INODE, 0));
+    if (id.second == 0 && !statFile(encoded, &id, &fileEntry)) {
+        return;
+    }
+
+    if (*first >= 0) {
+        // Only now is the first file of the size told apart, its entry was
+        // not kept
+        const QByteArray firstPath(m_firstPaths.constData() + *first);
+        FileId firstId;
+        KIO::UDSEntry firstEntry;
+        if (!statFile(firstPath, &firstId, &firstEntry)) {
+            *first = m_firstPaths.size();
+            m_firstPaths.append(encoded).append('\0');
+            return;
+        }
+        if (firstId == id) {
+            KQueryStats::add(KQueryStats::LinksCollapsed);
+            return;
+        }
+        *first = -1;
+        QSet<FileId> &files = m_sizeFiles[size];
+        files.insert(firstId);
+        files.insert(id);
+        addCandidate(firstPath, size, firstEntry);
+        addCandidate(encoded, size, fileEntry);
+        return;
+    }
+
+    QSet<FileId> &files = m_sizeFiles[size];
+    if (files.contains(id)) {
+        KQueryStats::add(KQueryStats::LinksCollapsed);
+        return;
+    }
+    files.insert(id);
+    addCandidate(encoded, size, fileEntry);
+}
+
+void KQueryDuplicateFinder::addCandidate(const QByteArray &path, KIO::filesize_t size, const KIO::UDSEntry &entry)
+{
+    m_entries.insert(path, entry);
+    hash(path, size, false);
+}
+
+bool KQueryDuplicateFinder::statFile(const QByteArray &path, FileId *id, KIO::UDSEntry *entry)
+{
+    struct stat buf;
+    KQueryStats::add(KQueryStats::StatsIssued);
+    if (::stat(path.constData(), &buf) != 0) {
+        return false;
+    }
+    *id = FileId(buf.st_dev, buf.st_ino);
+
+    QHash<uint, QString>::iterator user = m_userNames.find(buf.st_uid);
+    if (user == m_userNames.end()) {
+        user = m_userNames.insert(buf.st_uid, KUser(K_UID(buf.st_uid)).loginName());
+    }
+    QHash<uint, QString>::iterator group = m_groupNames.find(buf.st_gid);
+    if (group == m_groupNames.end()) {
+        group = m_groupNames.insert(buf.st_gid, KUserGroup(K_GID(buf.st_gid)).name());
+    }
+
+    entry->clear();
+    entry->insert(KIO::UDSEntry::UDS_NAME, QFile::decodeName(path.mid(path.lastIndexOf('/') + 1)));
+    entry->insert(KIO::UDSEntry::UDS_SIZE, qlonglong(buf.st_size));
+    entry->insert(KIO::UDSEntry::UDS_FILE_TYPE, buf.st_mode & S_IFMT);
+    entry->insert(KIO::UDSEntry::UDS_ACCESS, buf.st_mode & 07777);
+    entry->insert(KIO::UDSEntry::UDS_MODIFICATION_TIME, qlonglong(buf.st_mtime));
+    entry->insert(KIO::UDSEntry::UDS_ACCESS_TIME, qlonglong(buf.st_atime));
+    entry->insert(KIO::UDSEntry::UDS_USER, *user);
+    entry->insert(KIO::UDSEntry::UDS_GROUP, *group);
+    entry->insert(KIO::UDSEntry::UDS_DEVICE_ID, qlonglong(buf.st_dev));
+    entry->insert(KIO::UDSEntry::UDS_INODE, qlonglong(buf.st_ino));
+    return true;
+}
+
+void KQueryDuplicateFinder::hash(const QByteArray &path, KIO::filesize_t size, bool complete)
+{
+    m_pending++;
+    m_pool.start(new KQueryHashTask(this, m_generation.load(), path, size, complete));
+}
+
+void KQueryDuplicateFinder::cancel()
+{
+    m_generation.ref();
+    m_pool.clear();
+
+    m_sizes.clear();
+    m_firstPaths.clear();
+    m_sizeFiles.clear();
+    m_entries.clear();
+    m_partials.clear();
+    m_groups.clear();
+
+    QMutexLocker locker(&m_mutex);
+    m_hashed.clear();
+    m_finished = 0;
+    m_pending = 0;
+}
+
+int KQueryDuplicateFinder::pendingCount() const
+{
+    return m_pending;
+}
+
+QList<KQueryDuplicateGroup> KQueryDuplicateFinder::groups() const
+{
+    QList<KQueryDuplicateGroup> groups;
+    for (QHash<DigestKey, QList<QByteArray> >::const_iterator it = m_groups.constBegin(); it != m_groups.constEnd(); ++it) {
+        if (it->size() < 2) {
+            continue;
+        }
+        QList<QByteArray> paths = *it;
+        std::sort(paths.begin(), paths.end(), [](const QByteArray &a, const QByteArray &b) {
+            return QFile::decodeName(a) < QFile::decodeName(b);
+        });
+
+        KQueryDuplicateGroup group;
+        group.size = it.key().first;
+        for (const QByteArray &path : qAsConst(paths)) {
+            group.paths.append(QFile::decodeName(path));
+            group.entries.append(m_entries.value(path));
+        }
+        groups.append(group);
+    }
+
+    std::sort(groups.begin(), groups.end(), [](const KQueryDuplicateGroup &a, const KQueryDuplicateGroup &b) {
+        return a.reclaimable() > b.reclaimable();
+    });
+    for (int i = 0; i < groups.size(); i++) {
+        groups[i].number = i + 1;
+    }
+    return groups;
+}
+
+void KQueryDuplicateFinder::hashed(int generation, const Hashed &result, bool ok)
+{
+    QMutexLocker locker(&m_mutex);
+    if (isCanceled(generation)) {
+        return;
+    }
+
+    // One queued call delivers everything hashed until it runs
+    if (m_finished == 0) {
+        QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
+    }
+    m_finished++;
+    if (ok) {
+        m_hashed.append(result);
+    }
+}
+
+void KQueryDuplicateFinder::deliver()
+{
+    QList<Hashed> hashed;
+    int finished;
+    {
+        QMutexLocker locker(&m_mutex);
+        hashed.swap(m_hashed);
+        finished = m_finished;
+        m_finished = 0;
+    }
+
+    for (const Hashed &result : qAsConst(hashed)) {
+        if (result.complete) {
+            m_groups[DigestKey(result.size, result.digest)].append(result.path);
+            continue;
+        }
+
+        // The ends are equal, only the whole files can tell
+        Candidates &candidates = m_partials[Key(result.size, result.hash)];
+        if (++candidates.count == 1) {
+            candidates.first = result.path;
+            continue;
+        }
+        if (candidates.count == 2) {
+            hash(candidates.first, result.size, true);
+            candidates.first = QByteArray();
+        }
+        hash(result.path, result.size, true);
+    }
+
+    m_pending -= finished;
+    if (m_pending == 0 && finished > 0) {
+        emit idle();
+    }
+}
@@ -0,0 +1,160 @@
+/*******************************************************************
+* kqueryduplicates.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYDUPLICATES_H
+#define KQUERYDUPLICATES_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+
+#include <kio/global.h>
+#include <kio/udsentry.h>
+
+/* Files with the same content */
+struct KQueryDuplicateGroup {
+    KQueryDuplicateGroup()
+        : size(0)
+        , number(0)
+    {
+    }
+
+    /* Bytes freed by keeping a single copy */
+    KIO::filesize_t reclaimable() const
+    {
+        return size * (paths.size() - 1);
+    }
+
+    /* Of each copy */
+    KIO::filesize_t size;
+    QStringList paths;
+    /* What was listed of each path, in the same order */
+    QList<KIO::UDSEntry> entries;
+    /* Position among the groups, 1 for the one reclaiming most */
+    int number;
+};
+
+/* Finds the files with equal content among the files added to it.
+ *
+ * Files are only read when they could have a copy: a file with a size
+ * no other file has is never opened. Files of the same size are hashed
+ * over their first and last 64 KiB, and only the files whose partial
+ * hashes collide are hashed as a whole, with SHA-256 so that files told
+ * to be equal are. The first file of a size is kept as an encoded path
+ * in one shared buffer until a second file turns up, so files that turn
+ * out to be unique cost little more than their path. Hard links to one
+ * file are no copies, they are told apart by device and inode once a
+ * size has a second file. Hashing runs on a thread pool, cancellation
+ * works like KQueryContentScanner. */
+class KQueryDuplicateFinder : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KQueryDuplicateFinder(QObject *parent = nullptr);
+    ~KQueryDuplicateFinder();
+
+    /* entry is what was listed of the file, it is kept for the groups.
+     * Without an inode in it the file is stat'ed when needed. */
+    void add(const QString &path, KIO::filesize_t size, const KIO::UDSEntry &entry);
+    /* Drops everything added and stops the hashing */
+    void cancel();
+    /* Files being hashed */
+    int pendingCount() const;
+    /* The groups found, most bytes reclaimable first. Complete once
+     * pendingCount() is 0 and no more files are added. */
+    QList<KQueryDuplicateGroup> groups() const;
+
+    bool isCanceled(int generation) const
+    {
+        return m_generation.load() != generation;
+    }
+
+Q_SIGNALS:
+    /* Every file queued has been hashed */
+    void idle();
+
+private Q_SLOTS:
+    void deliver();
+
+private:
+    friend class KQueryHashTask;
+
+    struct Hashed {
+        QByteArray path;
+        KIO::filesize_t size;
+        // Of the ends of the file
+        quint64 hash;
+        // Of the whole file, if complete
+        QByteArray digest;
+        bool complete;
+    };
+
+    // The first path of a partial hash, until another one shows up
+    struct Candidates {
+        Candidates()
+            : count(0)
+        {
+        }
+
+        QByteArray first;
+        int count;
+    };
+
+    typedef QPair<KIO::filesize_t, quint64> Key;
+    typedef QPair<KIO::filesize_t, QByteArray> DigestKey;
+    // st_dev and st_ino
+    typedef QPair<quint64, quint64> FileId;
+
+    /* Called from the pool threads, ok is false if the file could not be read */
+    void hashed(int generation, const Hashed &result, bool ok);
+    void hash(const QByteArray &path, KIO::filesize_t size, bool complete);
+    /* Hashes the ends of a file that may have a copy */
+    void addCandidate(const QByteArray &path, KIO::filesize_t size, const KIO::UDSEntry &entry);
+    /* The entry of a file not listed with its inode */
+    bool statFile(const QByteArray &path, FileId *id, KIO::UDSEntry *entry);
+    QThreadPool m_pool;
+    QAtomicInt m_generation;
+    int m_pending;
+
+    // The offset of the first path of a size in m_firstPaths, -1 once
+    // the size has several files
+    QHash<KIO::filesize_t, int> m_sizes;
+    // NUL terminated paths
+    QByteArray m_firstPaths;
+    // The files of the sizes having several, to drop further hard links
+    QHash<KIO::filesize_t, QSet<FileId> > m_sizeFiles;
+    QHash<QByteArray, KIO::UDSEntry> m_entries;
+    QHash<Key, Candidates> m_partials;
+    QHash<DigestKey, QList<QByteArray> > m_groups;
+    QHash<uint, QString> m_userNames;
+    QHash<uint, QString> m_groupNames;
+
+    // Filled by the pool threads, emptied by deliver()
+    QMutex m_mutex;
+    QList<Hashed> m_hashed;
+    int m_finished;
+};
+
+#endif
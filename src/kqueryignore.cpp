@@ -0,0 +1,214 @@
+/*******************************************************************
+* kqueryignore.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kqueryignore.h"
+#include "kfind_debug.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QScopedPointer>
+#include <QStringList>
+
+/* A gitignore pattern as regular expression: wildcards do not match
+ * '/', except for "**" */
+static QString globToRegExp(const QString &glob)
+{
+    const int length = glob.length();
+    QString regexp;
+    for (int i = 0; i < length; i++) {
+        const QChar c = glob.at(i);
+        if (c == QLatin1Char('*')) {
+            if (i + 1 < length && glob.at(i + 1) == QLatin1Char('*')) {
+                const bool afterSlash = i == 0 || glob.at(i - 1) == QLatin1Char('/');
+                if (afterSlash && i + 2 < length && glob.at(i + 2) == QLatin1Char('/')) {
+                    // "**/" is any number of folders, none too
+                    regexp += QLatin1String("(?:.*/)?");
+                    i += 2;
+                    continue;
+                }
+                if (afterSlash && i + 2 == length) {
+                    // A trailing "/**" is everything below
+                    regexp += QLatin1String(".*");
+                    i++;
+                    continue;
+                }
+                i++;
+            }
+            regexp += QLatin1String("[^/]*");
+        } else if (c == QLatin1Char('?')) {
+            regexp += QLatin1String("[^/]");
+        } else if (c == QLatin1Char('[')) {
+            // A ']' right after the '[' is part of the set
+            int end = i + 1;
+            if (end < length && glob.at(end) == QLatin1Char('!')) {
+                end++;
+            }
+            if (end < length && glob.at(end) == QLatin1Char(']')) {
+                end++;
+            }
+            end = glob.indexOf(QLatin1Char(']'), end);
+            if (end == -1) {
+                regexp += QLatin1String("\\[");
+                continue;
+            }
+            QString set = glob.mid(i + 1, end - i - 1);
+            if (set.startsWith(QLatin1Char('!'))) {
+                set[0] = QLatin1Char('^');
+            }
+            set.replace(QLatin1Char('\\'), QLatin1String("\\\\"));
+            regexp += QLatin1Char('[') + set + QLatin1Char(']');
+            i = end;
+        } else if (c == QLatin1Char('\\') && i + 1 < length) {
+            regexp += QRegExp::escape(glob.at(++i));
+        } else {
+            regexp += QRegExp::escape(c);
+        }
+    }
+    return regexp;
+}
+
+KQueryIgnoreRules::KQueryIgnoreRules(const QString &dir, const Ptr &parent)
+    : m_dir(dir.endsWith(QLatin1Char('/')) ? dir : dir + QLatin1Char('/'))
+    , m_parent(parent)
+{
+}
+
+KQueryIgnoreRules::Ptr KQueryIgnoreRules::load(const QString &dir, const Ptr &parent)
+{
+    QScopedPointer<KQueryIgnoreRules> rules(new KQueryIgnoreRules(dir, parent));
+    // A .git folder, or file for worktrees and submodules, marks the top
+    const bool top = QFileInfo::exists(rules->m_dir + QLatin1String(".git"));
+    if (top) {
+        rules->m_checkout = rules->m_dir;
+    } else if (parent) {
+        rules->m_checkout = parent->m_checkout;
+    }
+
+    // Later rules win, so from the weakest file to the strongest
+    if (top) {
+        rules->readFile(rules->m_dir + QLatin1String(".git/info/exclude"));
+    }
+    if (!rules->m_checkout.isEmpty()) {
+        rules->readFile(rules->m_dir + QLatin1String(".gitignore"));
+    }
+    rules->readFile(rules->m_dir + QLatin1String(".ignore"));
+    // The top is kept even without rules, the folders below are in it
+    if (rules->m_rules.isEmpty() && !top) {
+        return parent;
+    }
+    return Ptr(rules.take());
+}
+
+KQueryIgnoreRules::Ptr KQueryIgnoreRules::loadAbove(const QString &root)
+{
+    QString dir = QDir::cleanPath(root);
+    if (QFileInfo::exists(dir + QLatin1String("/.git"))) {
+        return Ptr();
+    }
+
+    // The folders from the top of the checkout down to the parent of root
+    QStringList dirs;
+    while (dir != QLatin1String("/")) {
+        const int slash = dir.lastIndexOf(QLatin1Char('/'));
+        if (slash == -1) {
+            return Ptr();
+        }
+        dir = slash == 0 ? QStringLiteral("/") : dir.left(slash);
+        dirs.prepend(dir);
+        if (QFileInfo::exists(QDir(dir).filePath(QStringLiteral(".git")))) {
+            Ptr rules;
+            for (const QString &above : qAsConst(dirs)) {
+                rules = load(above, rules);
+            }
+            return rules;
+        }
+    }
+    return Ptr();
+}
+
+void KQueryIgnoreRules::readFile(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    while (!file.atEnd()) {
+        addRule(QString::fromUtf8(file.readLine()));
+    }
+}
+
+void KQueryIgnoreRules::addRule(QString line)
+{
+    while (line.endsWith(QLatin1Char('\n')) || line.endsWith(QLatin1Char('\r'))) {
+        line.chop(1);
+    }
+    // Trailing spaces are dropped unless escaped
+    while (line.endsWith(QLatin1Char(' ')) && !line.endsWith(QLatin1String("\\ "))) {
+        line.chop(1);
+    }
+    if (line.isEmpty() || line.startsWith(QLatin1Char('#'))) {
+        return;
+    }
+
+    Rule rule;
+    rule.negated = line.startsWith(QLatin1Char('!'));
+    if (rule.negated) {
+        line.remove(0, 1);
+    }
+    rule.dirOnly = line.endsWith(QLatin1Char('/'));
+    if (rule.dirOnly) {
+        line.chop(1);
+    }
+    rule.anchored = line.contains(QLatin1Char('/'));
+    if (line.startsWith(QLatin1Char('/'))) {
+        line.remove(0, 1);
+    }
+    if (line.isEmpty()) {
+        return;
+    }
+
+    rule.regexp = QRegExp(globToRegExp(line), Qt::CaseSensitive, QRegExp::RegExp2);
+    if (!rule.regexp.isValid()) {
+        qCDebug(KFING_LOG) << "Skipping ignore pattern" << line << "in" << m_dir;
+        return;
+    }
+    m_rules.append(rule);
+}
+
+bool KQueryIgnoreRules::isIgnored(const QString &path, bool isDir) const
+{
+    const QString name = path.mid(path.lastIndexOf(QLatin1Char('/')) + 1);
+    for (const KQueryIgnoreRules *rules = this; rules; rules = rules->m_parent.data()) {
+        if (!path.startsWith(rules->m_dir)) {
+            continue;
+        }
+        const QString relative = path.mid(rules->m_dir.length());
+        for (int i = rules->m_rules.size() - 1; i >= 0; i--) {
+            const Rule &rule = rules->m_rules.at(i);
+            if (rule.dirOnly && !isDir) {
+                continue;
+            }
+            if (rule.regexp.exactMatch(rule.anchored ? relative : name)) {
+                return !rule.negated;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,72 @@
+/*******************************************************************
+* kqueryignore.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYIGNORE_H
+#define KQUERYIGNORE_H
+
+#include <QRegExp>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+/* The rules of the .gitignore, .ignore and .git/info/exclude files of
+ * one folder, on top of those of the folders above it.
+ *
+ * The gitignore pattern format is followed: "#" comments, "!" negation,
+ * a trailing "/" for folders only, patterns with a "/" are relative to
+ * the folder of the file and "**" matches any number of folders. Rules
+ * of deeper folders and later lines win, .ignore wins over .gitignore.
+ * .gitignore files only count inside a git checkout and .git/info/exclude
+ * only at its top, .ignore files count everywhere.
+ * Only used from the thread that loaded them. */
+class KQueryIgnoreRules
+{
+public:
+    typedef QSharedPointer<const KQueryIgnoreRules> Ptr;
+
+    /* The rules for the local folder dir, parent if dir has no ignore files */
+    static Ptr load(const QString &dir, const Ptr &parent);
+    /* The rules of the folders above root, up to the top of the git
+     * checkout root is in; null outside of a checkout */
+    static Ptr loadAbove(const QString &root);
+
+    /* path is absolute */
+    bool isIgnored(const QString &path, bool isDir) const;
+
+private:
+    struct Rule {
+        QRegExp regexp;
+        bool negated;
+        bool dirOnly;
+        // Matched against the path below m_dir instead of the name
+        bool anchored;
+    };
+
+    KQueryIgnoreRules(const QString &dir, const Ptr &parent);
+    void readFile(const QString &fileName);
+    void addRule(QString line);
+
+    // With a trailing '/'
+    QString m_dir;
+    // The top of the checkout m_dir is in, with a trailing '/'; empty outside
+    QString m_checkout;
+    QVector<Rule> m_rules;
+    Ptr m_parent;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*******************************************************************
+* kquerymetainfocache.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kquerymetainfocache.h"
+#include "kquerycachedir.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <QScopedPointer>
+
+static const int cacheVersion = 2;
+static const qint64 maxCacheSize = 64 * 1024 * 1024;
+
+static KQueryCacheDir cacheDir()
+{
+    return KQueryCacheDir(QStringLiteral("metainfo"), QStringLiteral(".dat"), cacheVersion, maxCacheSize);
+}
+
+QString KQueryMetaInfoCache::key(const QString &path)
+{
+    return cacheDir().key(path);
+}
+
+bool KQueryMetaInfoCache::load(const QString &key, QHash<QString, QString> *values)
+{
+    QScopedPointer<QFile> file(cacheDir().open(key));
+    if (!file) {
+        return false;
+    }
+
+    QDataStream stream(file.data());
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream >> *values;
+    if (stream.status() != QDataStream::Ok) {
+        values->clear();
+        return false;
+    }
+    return true;
+}
+
+void KQueryMetaInfoCache::store(const QString &key, const QHash<QString, QString> &values)
+{
+    QScopedPointer<QSaveFile> file(cacheDir().create(key));
+    if (!file) {
+        return;
+    }
+
+    QDataStream stream(file.data());
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << values;
+    file->commit();
+}
+
+void KQueryMetaInfoCache::prune()
+{
+    cacheDir().prune();
+}
@@ -0,0 +1,46 @@
+/*******************************************************************
+* kquerymetainfocache.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYMETAINFOCACHE_H
+#define KQUERYMETAINFOCACHE_H
+
+#include <QHash>
+#include <QString>
+
+/* The metainfo extracted from files, kept on disk so that searching the
+ * same files again does not extract it again.
+ *
+ * All keys of a file are stored with their values as text, whichever
+ * keys were searched, so a search for another key hits too. The entries
+ * are kept in a KQueryCacheDir. All functions can be called from any
+ * thread. */
+class KQueryMetaInfoCache
+{
+public:
+    /* Empty if the file cannot be stat'ed */
+    static QString key(const QString &path);
+
+    /* false on a miss */
+    static bool load(const QString &key, QHash<QString, QString> *values);
+    static void store(const QString &key, const QHash<QString, QString> &values);
+
+    /* Removes the least recently used entries over the size limit */
+    static void prune();
+};
+
+#endif
@@ -0,0 +1,274 @@
+/*******************************************************************
+* kquerystats.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kquerystats.h"
+
+#include <algorithm>
+
+#include <QAtomicInteger>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QVector>
+
+#include <KLocalizedString>
+#include <kio/global.h>
+
+namespace {
+
+struct CounterBlock
+{
+    QAtomicInteger<quint64> counters[KQueryStats::CounterCount];
+    QAtomicInteger<quint64> stageNanos[KQueryStats::StageCount];
+};
+
+class Registry
+{
+public:
+    Registry()
+    {
+        clock.start();
+    }
+
+    void add(CounterBlock *block)
+    {
+        QMutexLocker locker(&mutex);
+        blocks.append(block);
+    }
+
+    // Keeps the counts of threads that went away
+    void retire(CounterBlock *block)
+    {
+        QMutexLocker locker(&mutex);
+        for (int i = 0; i < KQueryStats::CounterCount; i++) {
+            retired.counters[i].fetchAndAddRelaxed(block->counters[i].load());
+        }
+        for (int i = 0; i < KQueryStats::StageCount; i++) {
+            retired.stageNanos[i].fetchAndAddRelaxed(block->stageNanos[i].load());
+        }
+        blocks.removeOne(block);
+        delete block;
+    }
+
+    QMutex mutex;
+    QVector<CounterBlock *> blocks;
+    CounterBlock retired;
+    QElapsedTimer clock;
+};
+
+Q_GLOBAL_STATIC(Registry, registry)
+
+struct ThreadCounters
+{
+    ThreadCounters()
+        : block(new CounterBlock)
+    {
+        registry()->add(block);
+    }
+
+    ~ThreadCounters()
+    {
+        if (registry.isDestroyed()) {
+            delete block;
+        } else {
+            registry()->retire(block);
+        }
+    }
+
+    CounterBlock *block;
+};
+
+QAtomicInt currentSearchNumber;
+// The search the thread works for, -1 for the current one
+thread_local int threadSearch = -1;
+
+inline bool isCounted()
+{
+    return threadSearch < 0 || threadSearch == currentSearchNumber.load();
+}
+
+CounterBlock *threadBlock()
+{
+    static thread_local ThreadCounters counters;
+    return counters.block;
+}
+
+// Only the owning thread writes to a block, so no read-modify-write is needed
+inline void increment(QAtomicInteger<quint64> &value, quint64 amount)
+{
+    value.store(value.load() + amount);
+}
+
+}
+
+KQueryStats::Snapshot::Snapshot()
+    : elapsedNanos(0)
+{
+    std::fill(counters, counters + CounterCount, 0);
+    std::fill(stageNanos, stageNanos + StageCount, 0);
+}
+
+KQueryStats::Snapshot KQueryStats::Snapshot::operator-(const Snapshot &other) const
+{
+    Snapshot result;
+    for (int i = 0; i < CounterCount; i++) {
+        result.counters[i] = counters[i] - other.counters[i];
+    }
+    for (int i = 0; i < StageCount; i++) {
+        result.stageNanos[i] = stageNanos[i] - other.stageNanos[i];
+    }
+    result.elapsedNanos = elapsedNanos - other.elapsedNanos;
+    return result;
+}
+
+QString KQueryStats::Snapshot::toDisplayString() const
+{
+    quint64 rejected = 0;
+    for (int i = RejectedHidden; i <= RejectedContent; i++) {
+        rejected += counters[i];
+    }
+
+    return i18nc("search statistics in the status bar",
+                 "%1 folders, %2 entries (%3 rejected), %4 read from %5 files",
+                 counters[DirsListed], counters[EntriesSeen], rejected,
+                 KIO::convertSize(counters[BytesRead]), counters[FilesContentScanned] + counters[FilesHashed]);
+}
+
+QByteArray KQueryStats::Snapshot::toJson() const
+{
+    QJsonObject counterObject;
+    for (int i = 0; i < CounterCount; i++) {
+        counterObject.insert(QLatin1String(counterName(Counter(i))), double(counters[i]));
+    }
+    QJsonObject stageObject;
+    for (int i = 0; i < StageCount; i++) {
+        stageObject.insert(QLatin1String(stageName(Stage(i))), stageNanos[i] / 1e6);
+    }
+
+    QJsonObject object;
+    object.insert(QStringLiteral("elapsed_ms"), elapsedNanos / 1e6);
+    object.insert(QStringLiteral("counters"), counterObject);
+    object.insert(QStringLiteral("stages_ms"), stageObject);
+    return QJsonDocument(object).toJson(QJsonDocument::Compact);
+}
+
+void KQueryStats::add(Counter counter, quint64 value)
+{
+    if (isCounted()) {
+        increment(threadBlock()->counters[counter], value);
+    }
+}
+
+void KQueryStats::addTime(Stage stage, qint64 nanos)
+{
+    if (isCounted()) {
+        increment(threadBlock()->stageNanos[stage], nanos);
+    }
+}
+
+int KQueryStats::beginSearch()
+{
+    return currentSearchNumber.fetchAndAddRelaxed(1) + 1;
+}
+
+int KQueryStats::currentSearch()
+{
+    return currentSearchNumber.load();
+}
+
+KQueryStats::SearchScope::SearchScope(int search)
+    : m_previous(threadSearch)
+{
+    threadSearch = search;
+}
+
+KQueryStats::SearchScope::~SearchScope()
+{
+    threadSearch = m_previous;
+}
+
+KQueryStats::Snapshot KQueryStats::snapshot()
+{
+    Snapshot result;
+    Registry *r = registry();
+
+    QMutexLocker locker(&r->mutex);
+    QVector<const CounterBlock *> blocks;
+    blocks.reserve(r->blocks.size() + 1);
+    blocks.append(&r->retired);
+    for (const CounterBlock *block : qAsConst(r->blocks)) {
+        blocks.append(block);
+    }
+
+    for (const CounterBlock *block : qAsConst(blocks)) {
+        for (int i = 0; i < CounterCount; i++) {
+            result.counters[i] += block->counters[i].load();
+        }
+        for (int i = 0; i < StageCount; i++) {
+            result.stageNanos[i] += block->stageNanos[i].load();
+        }
+    }
+    result.elapsedNanos = r->clock.nsecsElapsed();
+    return result;
+}
+
+const char *KQueryStats::counterName(Counter counter)
+{
+    static const char *const names[CounterCount] = {
+        "dirs_listed",
+        "archives_listed",
+        "dirs_pruned",
+        "ignored_entries",
+        "mounts_skipped",
+        "dirs_seen_twice",
+        "links_collapsed",
+        "entries_seen",
+        "rejected_hidden",
+        "rejected_name",
+        "rejected_size",
+        "rejected_time",
+        "rejected_owner",
+        "rejected_type",
+        "rejected_metainfo",
+        "rejected_checksum",
+        "rejected_content",
+        "stats_issued",
+        "bytes_read",
+        "files_content_scanned",
+        "files_hashed",
+        "text_cache_hits",
+        "metainfo_cache_hits",
+        "checksum_cache_hits",
+        "files_found"
+    };
+    return names[counter];
+}
+
+const char *KQueryStats::stageName(Stage stage)
+{
+    static const char *const names[StageCount] = {
+        "listing",
+        "entries",
+        "stat",
+        "mimetype",
+        "metainfo",
+        "checksum",
+        "content"
+    };
+    return names[stage];
+}
@@ -0,0 +1,138 @@
+/*******************************************************************
+* kquerystats.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYSTATS_H
+#define KQUERYSTATS_H
+
+#include <QElapsedTimer>
+#include <QString>
+
+/* Search instrumentation counters.
+ *
+ * Every thread updates its own block of counters without locking or atomic
+ * read-modify-write operations; snapshot() sums the blocks of all threads.
+ * The counters only ever grow, a search is measured as the difference
+ * between two snapshots. Pool threads may still be finishing the work of
+ * a canceled search when the next one starts, what they count within a
+ * SearchScope of an older search is dropped. */
+class KQueryStats
+{
+public:
+    enum Counter {
+        DirsListed,
+        ArchivesListed,
+        DirsPruned,
+        IgnoredEntries,
+        MountsSkipped,
+        DirsSeenTwice,
+        LinksCollapsed,
+        EntriesSeen,
+        RejectedHidden,
+        RejectedName,
+        RejectedSize,
+        RejectedTime,
+        RejectedOwner,
+        RejectedType,
+        RejectedMetaInfo,
+        RejectedChecksum,
+        RejectedContent,
+        StatsIssued,
+        BytesRead,
+        FilesContentScanned,
+        FilesHashed,
+        TextCacheHits,
+        MetaInfoCacheHits,
+        ChecksumCacheHits,
+        FilesFound,
+        CounterCount
+    };
+
+    enum Stage {
+        // Waiting for folder listings
+        ListingStage,
+        // Making items of the entries listed
+        EntriesStage,
+        StatStage,
+        MimeTypeStage,
+        MetaInfoStage,
+        ChecksumStage,
+        ContentStage,
+        StageCount
+    };
+
+    struct Snapshot {
+        Snapshot();
+
+        quint64 counters[CounterCount];
+        quint64 stageNanos[StageCount];
+        qint64 elapsedNanos;
+
+        Snapshot operator-(const Snapshot &other) const;
+
+        /* One line summary for the status bar */
+        QString toDisplayString() const;
+        /* Compact JSON object, one line, for monitoring */
+        QByteArray toJson() const;
+    };
+
+    static void add(Counter counter, quint64 value = 1);
+    static void addTime(Stage stage, qint64 nanos);
+
+    /* Starts counting for a new search, returns its number */
+    static int beginSearch();
+    static int currentSearch();
+
+    static Snapshot snapshot();
+
+    static const char *counterName(Counter counter);
+    static const char *stageName(Stage stage);
+
+    /* Counts for search on the current thread until it goes out of scope.
+     * Work queued for a pool thread takes currentSearch() along. */
+    class SearchScope
+    {
+    public:
+        explicit SearchScope(int search);
+        ~SearchScope();
+
+    private:
+        int m_previous;
+    };
+
+    /* Adds the time until it goes out of scope to a stage */
+    class StageTimer
+    {
+    public:
+        explicit StageTimer(Stage stage)
+            : m_stage(stage)
+        {
+            m_timer.start();
+        }
+
+        ~StageTimer()
+        {
+            KQueryStats::addTime(m_stage, m_timer.nsecsElapsed());
+        }
+
+    private:
+        Stage m_stage;
+        QElapsedTimer m_timer;
+    };
+};
+
+#endif
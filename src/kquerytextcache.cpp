@@ -0,0 +1,57 @@
+/*******************************************************************
+* kquerytextcache.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kquerytextcache.h"
+#include "kquerycachedir.h"
+
+#include <QFile>
+#include <QSaveFile>
+
+static const int cacheVersion = 2;
+static const qint64 maxCacheSize = 256 * 1024 * 1024;
+static const qint64 maxCachedText = 32 * 1024 * 1024;
+
+static KQueryCacheDir cacheDir()
+{
+    return KQueryCacheDir(QStringLiteral("extracted-text"), QStringLiteral(".txt"), cacheVersion, maxCacheSize);
+}
+
+QString KQueryTextCache::key(const QString &path)
+{
+    return cacheDir().key(path);
+}
+
+QIODevice *KQueryTextCache::open(const QString &key)
+{
+    return cacheDir().open(key);
+}
+
+QSaveFile *KQueryTextCache::create(const QString &key)
+{
+    return cacheDir().create(key);
+}
+
+qint64 KQueryTextCache::maxEntrySize()
+{
+    return maxCachedText;
+}
+
+void KQueryTextCache::prune()
+{
+    cacheDir().prune();
+}
@@ -0,0 +1,51 @@
+/*******************************************************************
+* kquerytextcache.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYTEXTCACHE_H
+#define KQUERYTEXTCACHE_H
+
+#include <QString>
+
+class QIODevice;
+class QSaveFile;
+
+/* The text extracted from office documents, kept on disk so that
+ * searching the same documents again does not inflate them again.
+ *
+ * The entries are kept in a KQueryCacheDir. They are only written once a
+ * document was read to the end. All functions can be called from any
+ * thread. */
+class KQueryTextCache
+{
+public:
+    /* Empty if the file cannot be stat'ed */
+    static QString key(const QString &path);
+
+    /* The cached text, nullptr on a miss */
+    static QIODevice *open(const QString &key);
+    /* A file to write the text to, it is only kept once committed.
+     * nullptr if the cache cannot be written. */
+    static QSaveFile *create(const QString &key);
+    /* Texts longer than this are not cached */
+    static qint64 maxEntrySize();
+
+    /* Removes the least recently used entries over the size limit */
+    static void prune();
+};
+
+#endif
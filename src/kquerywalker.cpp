@@ -0,0 +1,721 @@
+/*******************************************************************
+* kquerywalker.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kquerywalker.h"
+#include "kfind_debug.h"
+#include "kquerystats.h"
+
+#include <sys/stat.h>
+#ifdef Q_OS_LINUX
+#include <sys/vfs.h>
+#endif
+
+#include <QFile>
+#include <QTimer>
+
+#include <kmountpoint.h>
+
+// Below this the estimate is mostly noise
+static const quint64 minDirsForEstimate = 16;
+static const qint64 minTimeForEstimate = 1000;
+
+// File systems that only show the state of the kernel, never any files
+// worth finding, by statfs() magic number where that is known
+#ifdef Q_OS_LINUX
+static const unsigned long pseudoFilesystemMagics[] = {
+    0x9fa0,     // proc
+    0x62656572, // sysfs
+    0x1cd1,     // devpts
+    0x27e0eb,   // cgroup
+    0x63677270, // cgroup2
+    0x64626720, // debugfs
+    0x74726163, // tracefs
+    0x73636673, // securityfs
+    0x6165676c, // pstore
+    0xcafe4a11, // bpf
+    0x62656570, // configfs
+    0x65735543, // fusectl
+    0x19800202, // mqueue
+    0x42494e4d, // binfmt_misc
+    0x958458f6  // hugetlbfs
+};
+#endif
+
+static const char *const pseudoFilesystemTypes[] = {
+    "proc", "procfs", "sysfs", "devpts", "devfs", "cgroup", "cgroup2", "debugfs",
+    "tracefs", "securityfs", "pstore", "bpf", "configfs", "fusectl", "mqueue",
+    "binfmt_misc", "hugetlbfs", "fdescfs", "linprocfs", "linsysfs"
+};
+
+// File systems served by another machine or by a process, which hang when
+// it stops answering. KMountPoint::probablySlow() misses FUSE and a few more.
+static const char *const networkFilesystemTypes[] = {
+    "nfs", "nfs4", "cifs", "smb", "smb3", "smbfs", "ncpfs", "afs", "9p",
+    "ceph", "glusterfs", "lustre", "davfs", "sshfs", "fuse", "fuseblk"
+};
+
+static bool isNetworkFilesystem(const KMountPoint::Ptr &mountPoint)
+{
+    if (mountPoint->probablySlow()) {
+        return true;
+    }
+    // fuse.sshfs and the like, fusectl is the local control file system
+    const QString type = mountPoint->mountType();
+    if (type.startsWith(QLatin1String("fuse."))) {
+        return true;
+    }
+    for (const char *networkType : networkFilesystemTypes) {
+        if (type == QLatin1String(networkType)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isPseudoFilesystem(const QString &mountPoint, const QString &type)
+{
+    // The mount table mostly tells, statfs() is only asked about the rest
+    for (const char *pseudoType : pseudoFilesystemTypes) {
+        if (type == QLatin1String(pseudoType)) {
+            return true;
+        }
+    }
+#ifdef Q_OS_LINUX
+    struct statfs buf;
+    if (::statfs(QFile::encodeName(mountPoint).constData(), &buf) == 0) {
+        for (unsigned long magic : pseudoFilesystemMagics) {
+            if (static_cast<unsigned long>(buf.f_type) == magic) {
+                return true;
+            }
+        }
+    }
+#else
+    Q_UNUSED(mountPoint);
+#endif
+    return false;
+}
+
+static QUrl childUrl(const QUrl &dir, const KIO::UDSEntry &entry, const QString &name)
+{
+    const QString url = entry.stringValue(KIO::UDSEntry::UDS_URL);
+    if (!url.isEmpty()) {
+        return QUrl(url);
+    }
+
+    QUrl child(dir);
+    QString path = child.path();
+    if (!path.endsWith(QLatin1Char('/'))) {
+        path += QLatin1Char('/');
+    }
+    child.setPath(path + name);
+    return child;
+}
+
+void KQueryPruneRules::setExcludedFolders(const QStringList &patterns)
+{
+    excludedNames.clear();
+    excludedPaths.clear();
+    for (const QString &pattern : patterns) {
+        const QString trimmed = pattern.trimmed();
+        if (trimmed.isEmpty()) {
+            continue;
+        }
+        const QRegExp regexp(trimmed, Qt::CaseSensitive, QRegExp::Wildcard);
+        if (trimmed.contains(QLatin1Char('/'))) {
+            excludedPaths.append(regexp);
+        } else {
+            excludedNames.append(regexp);
+        }
+    }
+}
+
+bool KQueryPruneRules::isPruned(const QString &name, const QString &path) const
+{
+    if (skipHidden && name.startsWith(QLatin1Char('.'))) {
+        return true;
+    }
+    for (const QRegExp &regexp : excludedNames) {
+        if (regexp.exactMatch(name)) {
+            return true;
+        }
+    }
+    for (const QRegExp &regexp : excludedPaths) {
+        if (regexp.exactMatch(path)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+KQueryWalker::KQueryWalker(QObject *parent)
+    : QObject(parent)
+    , m_recursive(false)
+    , m_minDepth(1)
+    , m_maxDepth(-1)
+    , m_useIgnoreFiles(false)
+    , m_maxJobs(4)
+    , m_running(false)
+    , m_stayOnFilesystem(false)
+    , m_followSymlinks(false)
+    , m_listInodes(false)
+    , m_rootDevice(0)
+    , m_maxJobsPerMount(1)
+    , m_mountTimeout(30000)
+    , m_mountFrontierSize(0)
+    , m_dirsDone(0)
+{
+    m_timeoutTimer = new QTimer(this);
+    m_timeoutTimer->setInterval(1000);
+    connect(m_timeoutTimer, &QTimer::timeout, this, &KQueryWalker::slotCheckTimeouts);
+}
+
+KQueryWalker::~KQueryWalker()
+{
+    for (KIO::ListJob *job : qAsConst(m_jobs)) {
+        job->kill(KJob::Quietly);
+    }
+}
+
+void KQueryWalker::setRecursive(bool recursive)
+{
+    m_recursive = recursive;
+}
+
+void KQueryWalker::setDepthRange(int minDepth, int maxDepth)
+{
+    m_minDepth = minDepth;
+    m_maxDepth = maxDepth;
+}
+
+void KQueryWalker::setPruneRules(const KQueryPruneRules &rules)
+{
+    m_pruneRules = rules;
+}
+
+void KQueryWalker::setUseIgnoreFiles(bool useIgnoreFiles)
+{
+    m_useIgnoreFiles = useIgnoreFiles;
+}
+
+void KQueryWalker::setMaxJobs(int maxJobs)
+{
+    m_maxJobs = qMax(1, maxJobs);
+}
+
+void KQueryWalker::setStayOnFilesystem(bool stayOnFilesystem)
+{
+    m_stayOnFilesystem = stayOnFilesystem;
+}
+
+void KQueryWalker::setFollowSymlinks(bool followSymlinks)
+{
+    m_followSymlinks = followSymlinks;
+}
+
+void KQueryWalker::setListInodes(bool listInodes)
+{
+    m_listInodes = listInodes;
+}
+
+void KQueryWalker::setNetworkMountLimits(int maxJobs, int timeout)
+{
+    m_maxJobsPerMount = qMax(1, maxJobs);
+    m_mountTimeout = timeout;
+}
+
+QString KQueryWalker::loadMounts(const QUrl &root)
+{
+    m_mounts.clear();
+    m_rootDevice = 0;
+    if (!root.isLocalFile()) {
+        return QString();
+    }
+
+    // Only the mount table is read, a dead mount is never touched here
+    const KMountPoint::List mountPoints = KMountPoint::currentMountPoints();
+    for (const KMountPoint::Ptr &mountPoint : mountPoints) {
+        Mount mount;
+        mount.type = mountPoint->mountType();
+        mount.network = isNetworkFilesystem(mountPoint);
+        m_mounts.insert(mountPoint->mountPoint(), mount);
+    }
+
+    // The root may be on a network mount itself
+    const KMountPoint::Ptr rootMount = mountPoints.findByPath(root.toLocalFile());
+    if (rootMount && isNetworkFilesystem(rootMount)) {
+        return rootMount->mountPoint();
+    }
+
+    if (m_stayOnFilesystem) {
+        struct stat buf;
+        if (::stat(QFile::encodeName(root.toLocalFile()).constData(), &buf) == 0) {
+            m_rootDevice = buf.st_dev;
+        }
+    }
+    return QString();
+}
+
+bool KQueryWalker::enterMount(const QString &path, Dir *child) const
+{
+    const QHash<QString, Mount>::const_iterator mount = m_mounts.constFind(path);
+    if (mount == m_mounts.constEnd()) {
+        return true;
+    }
+
+    if (mount->network) {
+        // Never the file system of the root, which is above the mount point
+        if (m_stayOnFilesystem) {
+            KQueryStats::add(KQueryStats::MountsSkipped);
+            return false;
+        }
+        if (m_deadMounts.contains(path)) {
+            return false;
+        }
+        child->mount = path;
+        return true;
+    }
+
+    // Local mount points do not hang, they can be looked at. Network and
+    // FUSE types are known from the mount table without touching them.
+    if (isPseudoFilesystem(path, mount->type)) {
+        KQueryStats::add(KQueryStats::MountsSkipped);
+        return false;
+    }
+    if (m_stayOnFilesystem) {
+        struct stat buf;
+        if (::stat(QFile::encodeName(path).constData(), &buf) != 0 || quint64(buf.st_dev) != m_rootDevice) {
+            KQueryStats::add(KQueryStats::MountsSkipped);
+            return false;
+        }
+    }
+    child->mount.clear();
+    return true;
+}
+
+bool KQueryWalker::firstVisit(const QString &path)
+{
+    // Follows the link, a folder is known by its inode whatever the path
+    struct stat buf;
+    KQueryStats::add(KQueryStats::StatsIssued);
+    if (::stat(QFile::encodeName(path).constData(), &buf) != 0) {
+        return false;
+    }
+    if (m_stayOnFilesystem && m_rootDevice != 0 && quint64(buf.st_dev) != m_rootDevice) {
+        return false;
+    }
+
+    const QPair<quint64, quint64> id(buf.st_dev, buf.st_ino);
+    if (m_visited.contains(id)) {
+        KQueryStats::add(KQueryStats::DirsSeenTwice);
+        return false;
+    }
+    m_visited.insert(id);
+    return true;
+}
+
+void KQueryWalker::enqueue(const Dir &dir)
+{
+    if (m_frontierPerDepth.size() <= dir.depth) {
+        m_frontierPerDepth.resize(dir.depth + 1);
+    }
+    m_frontierPerDepth[dir.depth]++;
+
+    if (dir.mount.isEmpty()) {
+        m_frontier.enqueue(dir);
+    } else {
+        m_mountFrontier[dir.mount].enqueue(dir);
+        m_mountFrontierSize++;
+    }
+}
+
+bool KQueryWalker::takeNext(Dir *dir)
+{
+    for (QHash<QString, QQueue<Dir> >::iterator it = m_mountFrontier.begin(); it != m_mountFrontier.end(); ++it) {
+        if (!it->isEmpty() && m_mountJobs.value(it.key()) < m_maxJobsPerMount) {
+            *dir = it->dequeue();
+            m_mountFrontierSize--;
+            m_frontierPerDepth[dir->depth]--;
+            return true;
+        }
+    }
+    if (m_frontier.isEmpty()) {
+        return false;
+    }
+    *dir = m_frontier.dequeue();
+    m_frontierPerDepth[dir->depth]--;
+    return true;
+}
+
+void KQueryWalker::dropMount(const QString &mount)
+{
+    m_deadMounts.insert(mount);
+    const QQueue<Dir> dropped = m_mountFrontier.take(mount);
+    for (const Dir &dir : dropped) {
+        m_frontierPerDepth[dir.depth]--;
+    }
+    m_mountFrontierSize -= dropped.size();
+}
+
+void KQueryWalker::start(const QUrl &root)
+{
+    for (KIO::ListJob *job : qAsConst(m_jobs)) {
+        job->kill(KJob::Quietly);
+    }
+    m_jobs.clear();
+    m_jobDirs.clear();
+    m_frontier.clear();
+    m_mountFrontier.clear();
+    m_mountFrontierSize = 0;
+    m_mountJobs.clear();
+    m_deadMounts.clear();
+    m_visited.clear();
+    m_frontierPerDepth.clear();
+    m_samples.clear();
+    m_dirsDone = 0;
+    m_clock.start();
+    m_running = true;
+
+    Dir dir;
+    dir.url = root;
+    dir.depth = 0;
+    dir.subdirs = 0;
+    dir.mount = loadMounts(root);
+    dir.started = 0;
+    dir.listStarted = 0;
+    if (m_followSymlinks && root.isLocalFile()) {
+        firstVisit(root.toLocalFile());
+    }
+    if (m_useIgnoreFiles && root.isLocalFile()) {
+        // Searching a part of a checkout, its ignore files still apply
+        dir.ignoreRules = KQueryIgnoreRules::loadAbove(root.toLocalFile());
+    }
+    enqueue(dir);
+    startJobs();
+}
+
+void KQueryWalker::kill()
+{
+    abort(KIO::ERR_USER_CANCELED);
+}
+
+void KQueryWalker::stop()
+{
+    abort(0);
+}
+
+void KQueryWalker::abort(int error)
+{
+    if (!m_running) {
+        return;
+    }
+
+    for (KIO::ListJob *job : qAsConst(m_jobs)) {
+        job->kill(KJob::Quietly);
+    }
+    m_jobs.clear();
+    m_jobDirs.clear();
+    m_frontier.clear();
+    m_mountFrontier.clear();
+    m_mountFrontierSize = 0;
+    m_mountJobs.clear();
+    m_frontierPerDepth.clear();
+
+    finish(error);
+}
+
+bool KQueryWalker::isRunning() const
+{
+    return m_running;
+}
+
+int KQueryWalker::pendingDirs() const
+{
+    return m_frontier.size() + m_mountFrontierSize + m_jobs.size();
+}
+
+QUrl KQueryWalker::currentDir() const
+{
+    return m_jobs.isEmpty() ? QUrl() : m_jobDirs.value(m_jobs.first()).url;
+}
+
+void KQueryWalker::startJobs()
+{
+    Dir dir;
+    while (m_jobs.size() < m_maxJobs && takeNext(&dir)) {
+        if (m_useIgnoreFiles && dir.url.isLocalFile()) {
+            // Read before the entries arrive, which they apply to
+            dir.ignoreRules = KQueryIgnoreRules::load(dir.url.toLocalFile(), dir.ignoreRules);
+        }
+
+        KQueryStats::add(KQueryStats::DirsListed);
+        KIO::ListJob *job = KIO::listDir(dir.url, KIO::HideProgressInfo);
+        if (m_listInodes) {
+            // kio_file only adds them from this level of detail on
+            job->addMetaData(QStringLiteral("details"), QStringLiteral("3"));
+        }
+        connect(job, &KIO::ListJob::entries, this, &KQueryWalker::slotEntries);
+        connect(job, &KJob::result, this, &KQueryWalker::slotResult);
+        dir.listStarted = m_clock.nsecsElapsed();
+
+        if (!dir.mount.isEmpty()) {
+            m_mountJobs[dir.mount]++;
+            dir.started = m_clock.elapsed();
+            if (m_mountTimeout > 0 && !m_timeoutTimer->isActive()) {
+                m_timeoutTimer->start();
+            }
+        }
+
+        m_jobs.append(job);
+        m_jobDirs.insert(job, dir);
+    }
+
+    if (m_jobs.isEmpty() && m_running) {
+        finish(0);
+    }
+}
+
+void KQueryWalker::slotEntries(KIO::Job *job, const KIO::UDSEntryList &list)
+{
+    const QHash<KJob *, Dir>::iterator dir = m_jobDirs.find(job);
+    if (dir == m_jobDirs.end()) {
+        return;
+    }
+
+    // Ignored entries are dropped here, ignored folders are not listed
+    KIO::UDSEntryList kept;
+    const bool filter = m_useIgnoreFiles && dir->url.isLocalFile();
+    if (filter) {
+        kept.reserve(list.size());
+        for (const KIO::UDSEntry &entry : list) {
+            if (isIgnored(*dir, entry, entry.stringValue(KIO::UDSEntry::UDS_NAME))) {
+                KQueryStats::add(KQueryStats::IgnoredEntries);
+            } else {
+                kept.append(entry);
+            }
+        }
+    }
+    const KIO::UDSEntryList &reported = filter ? kept : list;
+
+    // The entries of dir are one deeper than dir, its subfolders are only
+    // listed if their entries are within the range
+    const int depth = dir->depth + 1;
+    if (m_recursive && (m_maxDepth < 0 || depth < m_maxDepth)) {
+        for (const KIO::UDSEntry &entry : reported) {
+            // Unless asked, links to folders are not followed, like
+            // KIO::listRecursive()
+            if (!entry.isDir() || (entry.isLink() && !(m_followSymlinks && dir->url.isLocalFile()))) {
+                continue;
+            }
+            const QString name = entry.stringValue(KIO::UDSEntry::UDS_NAME);
+            if (name == QLatin1String(".") || name == QLatin1String("..")) {
+                continue;
+            }
+
+            Dir child;
+            child.url = childUrl(dir->url, entry, name);
+            // Pruned folders are still reported as entries, just not listed
+            if (!m_pruneRules.isEmpty() && m_pruneRules.isPruned(name, child.url.path())) {
+                KQueryStats::add(KQueryStats::DirsPruned);
+                continue;
+            }
+            child.depth = depth;
+            child.subdirs = 0;
+            child.ignoreRules = dir->ignoreRules;
+            child.mount = dir->mount;
+            child.started = 0;
+            child.listStarted = 0;
+            if (!m_mounts.isEmpty() && !enterMount(child.url.toLocalFile(), &child)) {
+                continue;
+            }
+            if (!child.mount.isEmpty() && m_deadMounts.contains(child.mount)) {
+                continue;
+            }
+            // The target of a link may be anywhere, even above the link
+            if (m_followSymlinks && child.url.isLocalFile() && !firstVisit(child.url.toLocalFile())) {
+                continue;
+            }
+            enqueue(child);
+            dir->subdirs++;
+        }
+    }
+
+    // Still too shallow, the folders were all that was needed
+    if (depth < m_minDepth) {
+        return;
+    }
+
+    // A slot killing the walk invalidates dir
+    const QUrl url = dir->url;
+    emit entries(url, reported);
+}
+
+bool KQueryWalker::isIgnored(const Dir &dir, const KIO::UDSEntry &entry, const QString &name) const
+{
+    if (name == QLatin1String(".") || name == QLatin1String("..")) {
+        return false;
+    }
+    // Nothing in there is part of the checkout
+    if (name == QLatin1String(".git")) {
+        return true;
+    }
+    if (!dir.ignoreRules) {
+        return false;
+    }
+
+    QString path = dir.url.toLocalFile();
+    if (!path.endsWith(QLatin1Char('/'))) {
+        path += QLatin1Char('/');
+    }
+    return dir.ignoreRules->isIgnored(path + name, entry.isDir());
+}
+
+void KQueryWalker::slotResult(KJob *job)
+{
+    const QHash<KJob *, Dir>::iterator it = m_jobDirs.find(job);
+    if (it == m_jobDirs.end()) {
+        return;
+    }
+    const Dir dir = *it;
+    m_jobDirs.erase(it);
+    m_jobs.removeOne(static_cast<KIO::ListJob *>(job));
+    if (!dir.mount.isEmpty()) {
+        m_mountJobs[dir.mount]--;
+    }
+    // From the request to the last entries, jobs listing at the same time
+    // all count
+    KQueryStats::addTime(KQueryStats::ListingStage, m_clock.nsecsElapsed() - dir.listStarted);
+
+    if (job->error()) {
+        if (dir.depth == 0) {
+            abort(job->error());
+            return;
+        }
+        // Same as KIO::listRecursive(), an unreadable subfolder does not fail the search
+        qCDebug(KFING_LOG) << "Cannot list" << dir.url << job->errorString();
+    }
+
+    jobDone(dir);
+}
+
+void KQueryWalker::jobDone(const Dir &dir)
+{
+    if (m_samples.size() <= dir.depth) {
+        m_samples.resize(dir.depth + 1);
+    }
+    m_samples[dir.depth].listed++;
+    m_samples[dir.depth].subdirs += dir.subdirs;
+    m_dirsDone++;
+
+    startJobs();
+}
+
+void KQueryWalker::slotCheckTimeouts()
+{
+    const qint64 now = m_clock.elapsed();
+    const QList<KIO::ListJob *> jobs = m_jobs;
+    for (KIO::ListJob *job : jobs) {
+        const QHash<KJob *, Dir>::iterator it = m_jobDirs.find(job);
+        if (it == m_jobDirs.end() || it->mount.isEmpty() || now - it->started < m_mountTimeout) {
+            continue;
+        }
+
+        // A mount this slow is likely dead, its other folders are skipped
+        // too, also those being listed right now
+        const QString mount = it->mount;
+        qCDebug(KFING_LOG) << "Listing" << it->url << "timed out, skipping" << mount;
+        KQueryStats::add(KQueryStats::MountsSkipped);
+        dropMount(mount);
+
+        bool rootLost = false;
+        const QList<KIO::ListJob *> running = m_jobs;
+        for (KIO::ListJob *other : running) {
+            const QHash<KJob *, Dir>::iterator dir = m_jobDirs.find(other);
+            if (dir == m_jobDirs.end() || dir->mount != mount) {
+                continue;
+            }
+            rootLost = rootLost || dir->depth == 0;
+            if (m_samples.size() <= dir->depth) {
+                m_samples.resize(dir->depth + 1);
+            }
+            m_samples[dir->depth].listed++;
+            m_samples[dir->depth].subdirs += dir->subdirs;
+            m_dirsDone++;
+            other->kill(KJob::Quietly);
+            m_jobDirs.erase(dir);
+            m_jobs.removeOne(other);
+            m_mountJobs[mount]--;
+        }
+
+        if (rootLost) {
+            abort(KIO::ERR_SERVER_TIMEOUT);
+            return;
+        }
+        startJobs();
+        if (!m_running) {
+            return;
+        }
+    }
+
+    for (const Dir &dir : qAsConst(m_jobDirs)) {
+        if (!dir.mount.isEmpty()) {
+            return;
+        }
+    }
+    m_timeoutTimer->stop();
+}
+
+void KQueryWalker::finish(int error)
+{
+    m_running = false;
+    m_timeoutTimer->stop();
+    emit finished(error);
+}
+
+double KQueryWalker::estimatedRemainingDirs() const
+{
+    // Folders below a folder at depth d, estimated from how many subfolders
+    // the folders at each depth had so far. Depths not sampled yet count as
+    // leaves, so the estimate grows while the walk goes deeper.
+    const int depths = qMax(m_samples.size(), m_frontierPerDepth.size());
+    QVector<double> below(depths + 1, 0.0);
+    for (int depth = depths - 1; depth >= 0; depth--) {
+        if (depth < m_samples.size() && m_samples.at(depth).listed > 0) {
+            const DepthSample &sample = m_samples.at(depth);
+            const double fanOut = double(sample.subdirs) / sample.listed;
+            below[depth] = fanOut * (1.0 + below[depth + 1]);
+        }
+    }
+
+    double remaining = 0.0;
+    for (int depth = 0; depth < m_frontierPerDepth.size(); depth++) {
+        remaining += m_frontierPerDepth.at(depth) * (1.0 + below[depth]);
+    }
+    for (KIO::ListJob *job : m_jobs) {
+        remaining += 1.0 + below[m_jobDirs.value(job).depth];
+    }
+    return remaining;
+}
+
+qint64 KQueryWalker::estimatedRemainingTime() const
+{
+    const qint64 elapsed = m_clock.elapsed();
+    if (!m_running || m_dirsDone < minDirsForEstimate || elapsed < minTimeForEstimate) {
+        return -1;
+    }
+    return qint64(estimatedRemainingDirs() * elapsed / m_dirsDone);
+}
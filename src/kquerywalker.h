@@ -0,0 +1,210 @@
+/*******************************************************************
+* kquerywalker.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYWALKER_H
+#define KQUERYWALKER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPair>
+#include <QQueue>
+#include <QRegExp>
+#include <QSet>
+#include <QStringList>
+#include <QUrl>
+#include <QVector>
+
+#include <kio/job.h>
+
+#include "kqueryignore.h"
+
+class QTimer;
+
+/* Which folders are not descended into, so nothing below them is listed */
+struct KQueryPruneRules {
+    KQueryPruneRules()
+        : skipHidden(false)
+    {
+    }
+
+    /* Wildcard patterns; matched against the whole path if they contain
+     * a '/', else against the folder name */
+    void setExcludedFolders(const QStringList &patterns);
+
+    bool isEmpty() const
+    {
+        return !skipHidden && excludedNames.isEmpty() && excludedPaths.isEmpty();
+    }
+
+    bool isPruned(const QString &name, const QString &path) const;
+
+    bool skipHidden;
+    QList<QRegExp> excludedNames;
+    QList<QRegExp> excludedPaths;
+};
+
+/* Walks a folder tree with one KIO::listDir() job per folder.
+ *
+ * Unlike KIO::listRecursive() the folders still to be listed are kept
+ * here, so a few of them can be listed at the same time and the walk
+ * can tell how much is left. */
+class KQueryWalker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KQueryWalker(QObject *parent = nullptr);
+    ~KQueryWalker();
+
+    void setRecursive(bool recursive);
+    /* The entries of the root are at depth 1. Folders are only listed
+     * while their entries are no deeper than maxDepth, and entries less
+     * deep than minDepth are not reported. maxDepth is at least 1, or -1
+     * for no limit. */
+    void setDepthRange(int minDepth, int maxDepth);
+    void setPruneRules(const KQueryPruneRules &rules);
+    /* Skip what .gitignore, .ignore and .git/info/exclude files of local
+     * folders ignore, and .git folders */
+    void setUseIgnoreFiles(bool useIgnoreFiles);
+    /* Number of folders listed at the same time */
+    void setMaxJobs(int maxJobs);
+    /* Do not descend into other file systems, like find -xdev */
+    void setStayOnFilesystem(bool stayOnFilesystem);
+    /* Descend into links to local folders too. Every folder is listed
+     * once however many links lead to it, which also ends link loops */
+    void setFollowSymlinks(bool followSymlinks);
+    /* Ask the KIO slave for UDS_DEVICE_ID and UDS_INODE of the entries */
+    void setListInodes(bool listInodes);
+    /* Folders of one network mount listed at the same time, and the
+     * milliseconds listing one of them may take before the whole mount
+     * is skipped */
+    void setNetworkMountLimits(int maxJobs, int timeout);
+
+    void start(const QUrl &root);
+    /* Abandons the walk and emits finished(KIO::ERR_USER_CANCELED) */
+    void kill();
+    /* Abandons the walk and emits finished(0), nothing more is needed */
+    void stop();
+    bool isRunning() const;
+
+    /* Folders queued or being listed */
+    int pendingDirs() const;
+    /* The folder that has been listed for the longest time */
+    QUrl currentDir() const;
+    /* Rough time left in milliseconds, -1 while there is too little to go by */
+    qint64 estimatedRemainingTime() const;
+
+Q_SIGNALS:
+    /* The entries of dir, including "." and ".." */
+    void entries(const QUrl &dir, const KIO::UDSEntryList &list);
+    /* error is the error of listing the root folder, errors of subfolders are skipped */
+    void finished(int error);
+
+private Q_SLOTS:
+    void slotEntries(KIO::Job *job, const KIO::UDSEntryList &list);
+    void slotResult(KJob *job);
+    void slotCheckTimeouts();
+
+private:
+    struct Dir {
+        QUrl url;
+        int depth;
+        quint64 subdirs;
+        // Of the parent until the folder is listed, then its own
+        KQueryIgnoreRules::Ptr ignoreRules;
+        // The network mount the folder is on, empty for local folders
+        QString mount;
+        // When listing started, for the timeout of network mounts
+        qint64 started;
+        // The same in nanoseconds, for the time spent listing
+        qint64 listStarted;
+    };
+
+    struct Mount {
+        QString type;
+        bool network;
+    };
+
+    // What listing the folders at one depth turned up so far
+    struct DepthSample {
+        DepthSample()
+            : listed(0)
+            , subdirs(0)
+        {
+        }
+
+        quint64 listed;
+        quint64 subdirs;
+    };
+
+    /* The network mount root is on, if any */
+    QString loadMounts(const QUrl &root);
+    /* Sets child.mount, false if the folder is not to be listed */
+    bool enterMount(const QString &path, Dir *child) const;
+    /* False if the folder at path was listed before, by another path */
+    bool firstVisit(const QString &path);
+    void enqueue(const Dir &dir);
+    bool takeNext(Dir *dir);
+    void dropMount(const QString &mount);
+    void startJobs();
+    void jobDone(const Dir &dir);
+    bool isIgnored(const Dir &dir, const KIO::UDSEntry &entry, const QString &name) const;
+    void abort(int error);
+    void finish(int error);
+    double estimatedRemainingDirs() const;
+
+    bool m_recursive;
+    int m_minDepth;
+    int m_maxDepth;
+    KQueryPruneRules m_pruneRules;
+    bool m_useIgnoreFiles;
+    int m_maxJobs;
+    bool m_running;
+
+    bool m_stayOnFilesystem;
+    bool m_followSymlinks;
+    bool m_listInodes;
+    // st_dev and st_ino of the folders queued when following links
+    QSet<QPair<quint64, quint64> > m_visited;
+    quint64 m_rootDevice;
+    int m_maxJobsPerMount;
+    int m_mountTimeout;
+    // Mount points below the root by path, read when the walk starts
+    QHash<QString, Mount> m_mounts;
+
+    QQueue<Dir> m_frontier;
+    // Folders of network mounts wait apart, so their cap does not hold
+    // up the local ones
+    QHash<QString, QQueue<Dir> > m_mountFrontier;
+    int m_mountFrontierSize;
+    QHash<QString, int> m_mountJobs;
+    QSet<QString> m_deadMounts;
+    QTimer *m_timeoutTimer;
+    QVector<int> m_frontierPerDepth;
+    // Running jobs in the order they were started
+    QList<KIO::ListJob *> m_jobs;
+    QHash<KJob *, Dir> m_jobDirs;
+
+    QVector<DepthSample> m_samples;
+    quint64 m_dirsDone;
+    QElapsedTimer m_clock;
+};
+
+#endif
@@ -0,0 +1,360 @@
+/*******************************************************************
+* kqueryxmltextdevice.cpp
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#include "kqueryxmltextdevice.h"
+
+#include <string.h>
+
+#include <QSaveFile>
+
+#include <kzip.h>
+
+// Bytes of XML read at once
+static const int chunkSize = 64 * 1024;
+// An entity left over from the previous chunk can add this much output
+static const int outputMargin = 32;
+
+static bool isXmlSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool nameIs(const char *name, int length, const char *wanted)
+{
+    const int wantedLength = int(strlen(wanted));
+    return length == wantedLength && memcmp(name, wanted, length) == 0;
+}
+
+static char *appendUtf8(char *out, uint code)
+{
+    if (code < 0x80) {
+        *out++ = char(code);
+    } else if (code < 0x800) {
+        *out++ = char(0xc0 | (code >> 6));
+        *out++ = char(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+        *out++ = char(0xe0 | (code >> 12));
+        *out++ = char(0x80 | ((code >> 6) & 0x3f));
+        *out++ = char(0x80 | (code & 0x3f));
+    } else {
+        *out++ = char(0xf0 | (code >> 18));
+        *out++ = char(0x80 | ((code >> 12) & 0x3f));
+        *out++ = char(0x80 | ((code >> 6) & 0x3f));
+        *out++ = char(0x80 | (code & 0x3f));
+    }
+    return out;
+}
+
+KQueryXmlTextDevice::KQueryXmlTextDevice(const KZip *archive, const QList<const KZipFileEntry *> &parts)
+    : m_archive(archive)
+    , m_parts(parts)
+    , m_nextPart(0)
+    , m_copyMaxSize(0)
+    , m_outPos(0)
+    , m_atEnd(false)
+    , m_state(Text)
+    , m_quote(0)
+    , m_closing(false)
+    , m_selfClosing(false)
+    , m_nameLength(0)
+    , m_entityLength(0)
+{
+    m_in.resize(chunkSize);
+    m_out.reserve(chunkSize + outputMargin);
+}
+
+KQueryXmlTextDevice::~KQueryXmlTextDevice()
+{
+}
+
+void KQueryXmlTextDevice::setCopy(QSaveFile *copy, qint64 maxSize)
+{
+    m_copy.reset(copy);
+    m_copyMaxSize = maxSize;
+}
+
+bool KQueryXmlTextDevice::copyMore()
+{
+    if (!m_copy) {
+        return false;
+    }
+    // Commits the copy once the end is reached
+    refill();
+    m_outPos = m_out.size();
+    return !m_copy.isNull();
+}
+
+qint64 KQueryXmlTextDevice::compressedBytesRead() const
+{
+    qint64 total = 0;
+    for (int i = 0; i < m_nextPart; i++) {
+        const KZipFileEntry *part = m_parts.at(i);
+        if (i == m_nextPart - 1 && !m_atEnd) {
+            // The inflater reads from the archive where it left off
+            total += qBound<qint64>(0, m_archive->device()->pos() - part->position(), part->compressedSize());
+        } else {
+            total += part->compressedSize();
+        }
+    }
+    return total;
+}
+
+bool KQueryXmlTextDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 KQueryXmlTextDevice::readData(char *data, qint64 maxSize)
+{
+    qint64 done = 0;
+    while (done < maxSize) {
+        if (m_outPos == m_out.size()) {
+            if (!refill()) {
+                break;
+            }
+            continue;
+        }
+        const qint64 length = qMin(maxSize - done, qint64(m_out.size() - m_outPos));
+        memcpy(data + done, m_out.constData() + m_outPos, size_t(length));
+        m_outPos += int(length);
+        done += length;
+    }
+    return (done == 0 && m_atEnd) ? -1 : done;
+}
+
+qint64 KQueryXmlTextDevice::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+bool KQueryXmlTextDevice::nextPart()
+{
+    m_source.reset();
+    while (m_nextPart < m_parts.size()) {
+        m_source.reset(m_parts.at(m_nextPart++)->createDevice());
+        if (m_source) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void KQueryXmlTextDevice::writeCopy()
+{
+    if (!m_copy) {
+        return;
+    }
+
+    if (m_copy->pos() + m_out.size() > m_copyMaxSize || m_copy->write(m_out) != m_out.size()) {
+        m_copy->cancelWriting();
+        m_copy.reset();
+        return;
+    }
+    if (m_atEnd) {
+        m_copy->commit();
+        m_copy.reset();
+    }
+}
+
+bool KQueryXmlTextDevice::refill()
+{
+    if (m_atEnd) {
+        return false;
+    }
+
+    // resize() keeps the reserved capacity, so this does not allocate
+    m_out.resize(chunkSize + outputMargin);
+    m_outPos = 0;
+    char *const begin = m_out.data();
+    char *out = begin;
+
+    qint64 length = m_source ? m_source->read(m_in.data(), m_in.size()) : 0;
+    while (length <= 0 && nextPart()) {
+        // Each part is a document of its own
+        m_state = Text;
+        length = m_source->read(m_in.data(), m_in.size());
+    }
+    if (length <= 0) {
+        m_atEnd = true;
+        // A document cut off inside an entity still shows its text
+        if (m_state == Entity) {
+            *out++ = '&';
+            memcpy(out, m_entity, size_t(m_entityLength));
+            out += m_entityLength;
+        }
+        m_out.resize(int(out - begin));
+        writeCopy();
+        return !m_out.isEmpty();
+    }
+
+    const char *const in = m_in.constData();
+    for (qint64 i = 0; i < length; i++) {
+        const char c = in[i];
+        switch (m_state) {
+        case Text:
+            if (c == '<') {
+                m_state = TagName;
+                m_nameLength = 0;
+                m_closing = false;
+                m_selfClosing = false;
+            } else if (c == '&') {
+                m_state = Entity;
+                m_entityLength = 0;
+            } else {
+                *out++ = c;
+            }
+            break;
+        case TagName:
+            if (c == '>') {
+                out = endTag(out);
+            } else if (c == '/' && m_nameLength == 0) {
+                m_closing = true;
+            } else if (c == '/' || isXmlSpace(c)) {
+                m_selfClosing = (c == '/');
+                m_state = Tag;
+            } else if (m_nameLength < int(sizeof(m_name))) {
+                m_name[m_nameLength++] = c;
+            }
+            break;
+        case Tag:
+            if (c == '>') {
+                out = endTag(out);
+            } else if (c == '"' || c == '\'') {
+                m_quote = c;
+                m_state = TagQuote;
+            } else if (!isXmlSpace(c)) {
+                m_selfClosing = (c == '/');
+            }
+            break;
+        case TagQuote:
+            if (c == m_quote) {
+                m_state = Tag;
+            }
+            break;
+        case Entity:
+            if (c == ';') {
+                out = endEntity(out);
+            } else if (m_entityLength < int(sizeof(m_entity)) && c != '&' && c != '<' && !isXmlSpace(c)) {
+                m_entity[m_entityLength++] = c;
+            } else {
+                // Not an entity after all, keep it as text and look at c again
+                *out++ = '&';
+                memcpy(out, m_entity, size_t(m_entityLength));
+                out += m_entityLength;
+                m_state = Text;
+                i--;
+            }
+            break;
+        }
+    }
+
+    m_out.resize(int(out - begin));
+    writeCopy();
+    return true;
+}
+
+char *KQueryXmlTextDevice::endTag(char *out)
+{
+    m_state = Text;
+
+    // Only the local name matters, prefixes differ between formats
+    const char *name = m_name;
+    int length = m_nameLength;
+    const char *colon = static_cast<const char *>(memchr(name, ':', size_t(length)));
+    if (colon) {
+        length -= int(colon + 1 - name);
+        name = colon + 1;
+    }
+
+    if (m_closing || m_selfClosing) {
+        // text:p, text:h, table:table-cell, KWord's PARAGRAPH, w:p and
+        // a:p of OOXML and the shared strings (si) of spreadsheets
+        if (nameIs(name, length, "p") || nameIs(name, length, "h")
+            || nameIs(name, length, "table-cell") || nameIs(name, length, "PARAGRAPH")
+            || nameIs(name, length, "si")) {
+            *out++ = '\n';
+            return out;
+        }
+    }
+    if (m_selfClosing) {
+        if (nameIs(name, length, "line-break") || nameIs(name, length, "br")) {
+            *out++ = '\n';
+        } else if (nameIs(name, length, "tab") || nameIs(name, length, "s")) {
+            *out++ = ' ';
+        }
+    }
+    return out;
+}
+
+char *KQueryXmlTextDevice::endEntity(char *out)
+{
+    m_state = Text;
+
+    const char *entity = m_entity;
+    const int length = m_entityLength;
+    if (nameIs(entity, length, "lt")) {
+        *out++ = '<';
+        return out;
+    } else if (nameIs(entity, length, "gt")) {
+        *out++ = '>';
+        return out;
+    } else if (nameIs(entity, length, "amp")) {
+        *out++ = '&';
+        return out;
+    } else if (nameIs(entity, length, "quot")) {
+        *out++ = '"';
+        return out;
+    } else if (nameIs(entity, length, "apos")) {
+        *out++ = '\'';
+        return out;
+    }
+
+    if (length > 1 && entity[0] == '#') {
+        const bool hex = entity[1] == 'x' || entity[1] == 'X';
+        bool ok = length > (hex ? 2 : 1);
+        uint code = 0;
+        for (int i = hex ? 2 : 1; i < length && ok; i++) {
+            const char c = entity[i];
+            uint digit;
+            if (c >= '0' && c <= '9') {
+                digit = uint(c - '0');
+            } else if (hex && c >= 'a' && c <= 'f') {
+                digit = uint(c - 'a' + 10);
+            } else if (hex && c >= 'A' && c <= 'F') {
+                digit = uint(c - 'A' + 10);
+            } else {
+                ok = false;
+                break;
+            }
+            code = code * (hex ? 16 : 10) + digit;
+            ok = code <= 0x10ffff;
+        }
+        if (ok && code != 0 && (code < 0xd800 || code > 0xdfff)) {
+            return appendUtf8(out, code);
+        }
+    }
+
+    // Unknown entities are kept as they are
+    *out++ = '&';
+    memcpy(out, entity, size_t(length));
+    out += length;
+    *out++ = ';';
+    return out;
+}
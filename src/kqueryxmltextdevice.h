@@ -0,0 +1,100 @@
+/*******************************************************************
+* kqueryxmltextdevice.h
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************/
+
+#ifndef KQUERYXMLTEXTDEVICE_H
+#define KQUERYXMLTEXTDEVICE_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QList>
+#include <QScopedPointer>
+
+class KZip;
+class KZipFileEntry;
+class QSaveFile;
+
+/* Reads the text of the XML files of a zip archive, as UTF-8, while they
+ * are inflated.
+ *
+ * Tags are dropped and the predefined and numeric entities are decoded.
+ * Paragraphs, table cells and line breaks of office documents end a
+ * line, so a line of text is a paragraph. Only two fixed size buffers
+ * are used, however large the document is. */
+class KQueryXmlTextDevice : public QIODevice
+{
+public:
+    /* The parts are read one after the other, their archive has to stay
+     * open while this device is used */
+    KQueryXmlTextDevice(const KZip *archive, const QList<const KZipFileEntry *> &parts);
+    ~KQueryXmlTextDevice();
+
+    /* Also writes the text to copy and commits it once all parts were
+     * read completely, so it is dropped if reading stops early and the
+     * rest is not read by copyMore(). Takes ownership of copy. */
+    void setCopy(QSaveFile *copy, qint64 maxSize);
+    /* Reads on into the copy only, one chunk at a time, for a reader that
+     * stopped early. false once the copy was committed or dropped. */
+    bool copyMore();
+
+    /* Compressed bytes of the parts inflated so far */
+    qint64 compressedBytesRead() const;
+
+    bool isSequential() const Q_DECL_OVERRIDE;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) Q_DECL_OVERRIDE;
+    qint64 writeData(const char *data, qint64 maxSize) Q_DECL_OVERRIDE;
+
+private:
+    enum State {
+        Text,
+        TagName,
+        Tag,
+        TagQuote,
+        Entity
+    };
+
+    bool refill();
+    bool nextPart();
+    void writeCopy();
+    char *endTag(char *out);
+    char *endEntity(char *out);
+
+    const KZip *m_archive;
+    QList<const KZipFileEntry *> m_parts;
+    int m_nextPart;
+    QScopedPointer<QIODevice> m_source;
+    QScopedPointer<QSaveFile> m_copy;
+    qint64 m_copyMaxSize;
+    QByteArray m_in;
+    QByteArray m_out;
+    int m_outPos;
+    bool m_atEnd;
+
+    State m_state;
+    char m_quote;
+    bool m_closing;
+    bool m_selfClosing;
+    // Longer names or entities are cut, they are only compared to short ones
+    char m_name[32];
+    int m_nameLength;
+    char m_entity[12];
+    int m_entityLength;
+};
+
+#endif
@@ -16,8 +16,11 @@
 *
 ******************************************************************/
 
+#include <stdio.h>
+
 #include <QDir>
 #include <QFile>
+#include <QScopedPointer>
 #include <QUrl>
 
 #include <KLocalizedString>
@@ -28,11 +31,15 @@
 #include <Kdelibs4ConfigMigrator>
 
 #include "kfinddlg.h"
+#include "kfindheadless.h"
+#include "kfindtrace.h"
 #include "kfind_version.h"
 
 int main(int argc, char **argv)
 {
-    QApplication app(argc, argv);
+    // Headless searches must not need (or connect to) a display
+    const bool headless = KFindHeadless::isRequested(argc, argv);
+    QScopedPointer<QCoreApplication> app(headless ? new QCoreApplication(argc, argv) : new QApplication(argc, argv));
     Kdelibs4ConfigMigrator migrate(QStringLiteral("kfind"));
     migrate.setConfigFiles(QStringList() << QStringLiteral("kfindrc"));
     migrate.migrate();
@@ -60,16 +67,24 @@ int main(int argc, char **argv)
     aboutData.addAuthor(i18n("Clarence Dang"), QString(), QStringLiteral("dang@kde.org"));
     aboutData.setTranslator(i18nc("NAME OF TRANSLATORS", "Your names"), i18nc("EMAIL OF TRANSLATORS", "Your emails"));
     // enable high dpi support
-    app.setAttribute(Qt::AA_UseHighDpiPixmaps, true);
+    QCoreApplication::setAttribute(Qt::AA_UseHighDpiPixmaps, true);
 
     QCommandLineParser parser;
     KAboutData::setApplicationData(aboutData);
     parser.addOption(QCommandLineOption(QStringList() <<  QStringLiteral("+[searchpath]"), i18n("Path(s) to search")));
+    KFindHeadless::addOptions(&parser);
+    parser.addOption(QCommandLineOption(QStringLiteral("trace"), i18n("Write a Chrome trace of the search pipeline to file (also set by KFIND_TRACE)"), i18n("file")));
 
     aboutData.setupCommandLine(&parser);
-    parser.process(app);
+    parser.process(*app);
     aboutData.processCommandLine(&parser);
 
+    const QString traceFile = parser.isSet(QStringLiteral("trace")) ? parser.value(QStringLiteral("trace"))
+                                                                     : QFile::decodeName(qgetenv("KFIND_TRACE"));
+    if (!traceFile.isEmpty()) {
+        KFindTrace::start(traceFile);
+    }
+
     QUrl url;
     if (!parser.positionalArguments().isEmpty())
     {
@@ -82,6 +97,16 @@ int main(int argc, char **argv)
         url = QUrl::fromLocalFile(QDir::homePath());
     }
 
+    if (headless) {
+        KFindHeadless search;
+        QString error;
+        if (!search.setQuery(parser, url, &error)) {
+            fprintf(stderr, "kfind: %s\n", qPrintable(error));
+            return 2;
+        }
+        return search.exec();
+    }
+
     KfindDlg kfinddlg(url);
     return kfinddlg.exec();
 }